@@ -9,13 +9,41 @@ cont()                    Continue program execution.
 pst()/pst(rad)            Print 48 or rad bytes of the stack before and after SP.
 emu:set_paused(-)         Pause/unpause emulator.
 emu:tick()                Execute one command.
+emu:run(n)                Execute n cycles. Like all emu:run* functions, returns the reason it stopped and the number of cycles run.
+emu:run_until_pc(a,sp,n)  Run until PC is a (and SP >= sp, if given), at most n cycles (if given).
+emu:run_until_halt(n)     Run until the calculator halts, e.g. to wait for a key.
+emu:run_until_lcd_change(n) Run until the screen changes.
+emu:run_until_mem(a,v,m,n) Run until data[a] & m == v. (m defaults to 0xFF)
+emu:cycles()              Number of cycles emulated so far.
+emu:latency()             Last, average and maximum input-to-photon latency in ms, and the number of presses measured.
+emu:stats()               Speed relative to real time, dropped cycles and skipped frames (see the `overload` key).
+emu:keys(seq,opts)        Press the keys in seq, e.g. "1+2=" or "{shift}{F5}", and run until the calculator waits for input.
+emu:run_until_settled(f,n) Run until halted, with no key pressed and the screen unchanged for f frames.
+emu:lcd()                 Screen dots as a packed bit string, width, height and the set of lit status icons.
+emu:lcd_font(name,font)   Add a font ({height=,space=,glyphs={["1"]={"..#..",...}}}) for emu:lcd_text.
+emu:lcd_text(font,y,l,r)  Decode the text line at row y (between columns l and r) with a font.
+emu:capture_start(p,n)    Record the screen every n frames to a stream, or to PNG files if p ends in .png.
+emu:capture_stop()        Stop recording the screen.
+emu:number(a)             Decode the calculator number at a. emu:set_number(a,v) stores one.
+emu:variables()           Table of all calculator variables listed in the model's `variables` table.
+emu:wait_cycles(n)        Suspend the script for n cycles while the emulator keeps running.
+emu:wait_pc/halt/lcd_change/mem(...) Suspend the script until the matching emu:run_until_* condition holds.
+emu:spawn(fn,...)         Run fn(...) as a separate script that may wait.
 emu:shutdown()            Shutdown the emulator.
+emu:on_pc(addr,fn)        Call fn whenever the CPU reaches addr.
+emu:on_call(addr,fn)      Call fn whenever addr is called with BL.
+emu:on_return(fn)         Call fn whenever a function returns.
+emu:on_halt/interrupt/frame/key/mem_error(fn) Call fn when the event happens.
 cpu.xxx                   Get register value.
 cpu.bt                    Current stack trace.
 code[-]                   Access code. (By bytes)
 data[-]                   Access data. (By bytes)
 data:watch(addr,fn)       Set write watchpoint.
 data:rwatch(addr,fn)      Set read watchpoint.
+data:read(addr,len,raw)   Read len bytes as a string. If raw is true, watchpoints are not triggered.
+data:write(addr,str,raw)  Write the bytes of str.
+data:read_u16/u32(addr)   Read a little-endian integer.
+cpu:get_all()             Table of all register values.
 help()                    Print this help message.
 addposttick(fn)           Add a function as post-tick handler. (wrapper over emu:post_tick)
 rmposttick(fn)            Remove a post-tick handler. If called without argument, delete the most-recently added handler.
@@ -135,11 +163,11 @@ function break_at(addr, commands)
     else
         commands = function() end
     end
-    if not next(break_targets) then
-        -- if break_targets is initially empty and later non-empty
-        addposttick(break_posttick)
-    end
     break_targets[addr] = commands
+    emu:on_pc(addr, function()
+        emu:set_paused(true)
+        commands()
+    end)
 end
 
 function unbreak_at(addr)
@@ -147,24 +175,13 @@ function unbreak_at(addr)
         addr = get_real_pc()
     end
     break_targets[addr] = nil
-    if not next(break_targets) then
-        rmposttick(break_posttick)
-    end
+    emu:on_pc(addr, nil)
 end
 
 function cont()
     emu:set_paused(false)
 end
 
-function break_posttick()
-    local real_pc = get_real_pc()
-    local commands = break_targets[real_pc]
-    if commands then
-        emu:set_paused(true)
-        commands()
-    end
-end
-
 function printf(...)
     print(string.format(...))
 end
@@ -242,13 +259,7 @@ function readdis(filename)
 end
 
 function until0(addr)
-    local old_sp = cpu.sp
-    while true do
-        emu:tick()
-        if get_real_pc() == addr and cpu.sp >= old_sp then
-            break
-        end
-    end
+    emu:run_until_pc(addr, cpu.sp)
 end
 
 function getn_str(x) -- Calculator 10-byte decimal fp number to string.
@@ -288,17 +299,14 @@ function getn_data(x) -- Calculator 10-byte decimal fp number to float.
 end
 
 function getn(adr)
-    local x = {}
-    for i = 0,9 do
-        x[i+1] = data[adr+i]
-    end
+    local x = {data:read(adr, 10):byte(1, 10)}
     local a = getn_str(x)
     if a then return a else return '<?>' end
 end
 
 function er(x)
     assert (0 <= x and x < 16 and x % 2 == 0)
-    return cpu['r' .. (x+1)] << 8 | cpu['r' .. x]
+    return cpu['er' .. x]
 end
 
 function ppc()
@@ -326,13 +334,7 @@ function nexti()
         return
     end
 
-    while true do
-        emu:tick()
-        if get_real_pc() == new_lr and cpu.sp == old_sp then
-            -- done
-            break
-        end
-    end
+    emu:run_until_pc(new_lr, old_sp)
 end
 
 function gets(adr, maxlen)
@@ -352,7 +354,7 @@ function gets(adr, maxlen)
 end
 
 function geti(adr)
-    return data[adr+1] << 8 | data[adr]
+    return data:read_u16(adr)
 end
 
 function s() emu:tick() ppc() end
@@ -630,8 +632,8 @@ end
 function pscr()
     local d={}
     for row=0,screen_nrow-1 do
-        for col=0,screen_ncol-1 do
-            table.insert(d,data[0xf800+screen_row_width*row+col])
+        for _,byte in ipairs({data:read(0xf800+screen_row_width*row,screen_ncol,true):byte(1,screen_ncol)}) do
+            table.insert(d,byte)
         end
     end
     print(getscr(d))
@@ -0,0 +1,260 @@
+#include "BatchServer.hpp"
+
+#include "Chipset/Chipset.hpp"
+#include "Emulator.hpp"
+#include "Logger.hpp"
+#include "Peripheral/Keyboard.hpp"
+#include "Peripheral/Screen.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace casioemu {
+#ifdef _WIN32
+    static int dup(int fd) {
+        return _dup(fd);
+    }
+
+    static int dup2(int fd, int fd2) {
+        return _dup2(fd, fd2);
+    }
+
+    static int write(int fd, const void *buffer, size_t size) {
+        return _write(fd, buffer, size);
+    }
+
+    static int close(int fd) {
+        return _close(fd);
+    }
+#endif
+
+    // Frames larger than this are taken as a broken stream.
+    static const uint32_t MAX_FRAME_SIZE = 64 << 20;
+
+    BatchServer::BatchServer(std::map<std::string, std::string> argv_map, size_t instances) {
+        // Keep the real stdout for responses and send everything else to stderr.
+        std::fflush(stdout);
+        output_fd = dup(1);
+        if (output_fd < 0 || dup2(2, 1) < 0)
+            PANIC("failed to redirect stdout\n");
+#ifdef _WIN32
+        _setmode(0, _O_BINARY);
+        _setmode(output_fd, _O_BINARY);
+#endif
+
+        pool.reset(new EmulatorPool(argv_map, instances));
+    }
+
+    BatchServer::~BatchServer() {
+        pool.reset();
+        close(output_fd);
+    }
+
+    void BatchServer::Run() {
+        pool->Wait();
+        pool->Submit([this](Emulator &emulator) {
+            auto state = std::make_shared<std::vector<uint8_t>>();
+            emulator.SaveState(*state);
+            std::lock_guard<std::mutex> states_lock(states_mx);
+            states["boot"] = state;
+        });
+        pool->Wait();
+        logger::Info("serving %zu instances\n", pool->Size());
+
+        std::vector<uint8_t> frame;
+        while (ReadFrame(frame))
+            HandleFrame(frame);
+        pool->Wait();
+    }
+
+    bool BatchServer::ReadFrame(std::vector<uint8_t> &frame) {
+        uint8_t length[4];
+        if (std::fread(length, 1, 4, stdin) != 4)
+            return false;
+        uint32_t size = length[0] | length[1] << 8 | length[2] << 16 | (uint32_t)length[3] << 24;
+        if (size > MAX_FRAME_SIZE) {
+            logger::Info("frame of %u bytes is too large\n", size);
+            return false;
+        }
+        frame.resize(size);
+        return std::fread(frame.data(), 1, size, stdin) == size;
+    }
+
+    void BatchServer::WriteFrame(const std::string &header, const uint8_t *body, size_t body_size) {
+        std::vector<uint8_t> frame(4);
+        uint32_t size = header.size() + 1 + body_size;
+        for (int ix = 0; ix != 4; ++ix)
+            frame[ix] = size >> (ix * 8);
+        frame.insert(frame.end(), header.begin(), header.end());
+        frame.push_back('\n');
+        frame.insert(frame.end(), body, body + body_size);
+
+        std::lock_guard<std::mutex> output_lock(output_mx);
+        for (size_t done = 0; done != frame.size();) {
+            int written = write(output_fd, frame.data() + done, frame.size() - done);
+            if (written <= 0)
+                PANIC("failed to write response\n");
+            done += written;
+        }
+    }
+
+    void BatchServer::WriteError(const std::string &id, const std::string &error) {
+        WriteFrame("id " + id + "\nerror " + error + "\n", nullptr, 0);
+    }
+
+    /**
+     * Parse (value) as a whole unsigned integer no greater than (max). Returns
+     * false for anything else, including signs and trailing characters.
+     */
+    static bool ParseHeaderNumber(const std::string &value, unsigned long long max, unsigned long long &number) {
+        if (value.empty() || value[0] < '0' || value[0] > '9')
+            return false;
+        char *end;
+        errno = 0;
+        number = std::strtoull(value.c_str(), &end, 0);
+        return !errno && *end == '\0' && number <= max;
+    }
+
+    void BatchServer::HandleFrame(const std::vector<uint8_t> &frame) {
+        Request request;
+        request.settle_frames = Emulator::KeyTiming().settle_frames;
+        request.max_cycles = 0;
+        std::string put_state;
+        // Reported once the whole header is read, so that it carries the id even if that comes later.
+        std::string error;
+
+        // Header lines up to the first empty one. The rest of the frame is the body.
+        size_t ix = 0;
+        while (ix != frame.size()) {
+            size_t end = ix;
+            while (end != frame.size() && frame[end] != '\n')
+                ++end;
+            std::string line(frame.begin() + ix, frame.begin() + end);
+            ix = end == frame.size() ? end : end + 1;
+            if (line.empty())
+                break;
+
+            size_t space = line.find(' ');
+            std::string key = line.substr(0, space);
+            std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+            if (key == "id")
+                request.id = value;
+            else if (key == "state")
+                request.state = value;
+            else if (key == "keys")
+                request.keys = value;
+            else if (key == "settle" || key == "max_cycles") {
+                unsigned long long number;
+                unsigned long long max = key == "settle" ? std::numeric_limits<unsigned int>::max() : std::numeric_limits<uint64_t>::max();
+                if (!ParseHeaderNumber(value, max, number)) {
+                    if (error.empty())
+                        error = "invalid " + key + " '" + value + "'";
+                } else if (key == "settle")
+                    request.settle_frames = number;
+                else
+                    request.max_cycles = number;
+            }
+            else if (key == "save")
+                request.save = value;
+            else if (key == "put_state")
+                put_state = value;
+            else if (error.empty())
+                error = "unknown key '" + key + "'";
+        }
+        if (!error.empty())
+            return WriteError(request.id, error);
+
+        // Uploaded states are stored right away, so that the requests after this one can use them.
+        if (!put_state.empty()) {
+            auto state = std::make_shared<const std::vector<uint8_t>>(frame.begin() + ix, frame.end());
+            {
+                std::lock_guard<std::mutex> states_lock(states_mx);
+                states[put_state] = state;
+            }
+            return WriteFrame("id " + request.id + "\n", nullptr, 0);
+        }
+
+        EmulatorPool::Snapshot state;
+        {
+            std::lock_guard<std::mutex> states_lock(states_mx);
+            auto it = states.find(request.state.empty() ? "boot" : request.state);
+            if (it != states.end())
+                state = it->second;
+        }
+        if (!state)
+            return WriteError(request.id, "unknown state '" + request.state + "'");
+
+        pool->Submit([this, state, request](Emulator &emulator) {
+            std::string error;
+            if (!emulator.LoadState(state->data(), state->size(), error))
+                return WriteError(request.id, "state '" + request.state + "' " + error);
+            RunRequest(emulator, request);
+        });
+    }
+
+    void BatchServer::RunRequest(Emulator &emulator, const Request &request) {
+        std::vector<uint8_t> codes;
+        std::string error;
+        if (!emulator.chipset.keyboard->LookupKeys(request.keys, codes, error))
+            return WriteError(request.id, error);
+
+        Emulator::KeyTiming timing;
+        timing.settle_frames = request.settle_frames;
+        timing.settle_max_cycles = request.max_cycles;
+        Uint64 cycles_run;
+        Emulator::RunStopReason reason = emulator.TypeKeys(codes, timing, cycles_run);
+
+        if (!request.save.empty()) {
+            auto saved = std::make_shared<std::vector<uint8_t>>();
+            emulator.SaveState(*saved);
+            std::lock_guard<std::mutex> states_lock(states_mx);
+            states[request.save] = saved;
+        }
+
+        std::ostringstream header;
+        header << "id " << request.id << "\n";
+        header << "reason " << Emulator::run_stop_reason_names[reason] << "\n";
+        header << "cycles " << cycles_run << "\n";
+
+        ScreenBase &screen = *emulator.chipset.screen;
+        std::vector<const char *> icons;
+        screen.ReadStatus(icons);
+        header << "icons";
+        for (const char *icon : icons)
+            header << " " << icon;
+        header << "\n";
+
+        std::vector<double> values;
+        emulator.ReadCalcVariables(values);
+        size_t index = 0;
+        char number[32];
+        for (auto &variable : emulator.calc_variables) {
+            header << "var " << variable.name;
+            for (size_t ix = 0; ix != (variable.count ? variable.count : 1); ++ix, ++index) {
+                if (std::isnan(values[index]))
+                    header << " nan";
+                else {
+                    std::snprintf(number, sizeof(number), " %.15g", values[index]);
+                    header << number;
+                }
+            }
+            header << "\n";
+        }
+
+        std::vector<uint8_t> dots;
+        screen.ReadDots(dots);
+        header << "lcd " << screen.GetWidth() << " " << screen.GetHeight() << "\n";
+        WriteFrame(header.str(), dots.data(), dots.size());
+    }
+} // namespace casioemu
@@ -0,0 +1,68 @@
+#pragma once
+#include "Config.hpp"
+
+#include "EmulatorPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace casioemu {
+    class Emulator;
+
+    /**
+     * Serves batch evaluation requests from other programs over stdin and
+     * stdout. Every message is a frame: a 32-bit little endian length followed
+     * by that many bytes. A frame holds header lines of the form "key value",
+     * an empty line and an optional binary body.
+     *
+     * Requests are handed to an EmulatorPool as they arrive and answered as
+     * soon as they finish, so responses may come out of order; the `id` of a
+     * request is copied to its response to match them up. See the README for
+     * the keys.
+     *
+     * While the server runs, anything else written to stdout (log messages,
+     * Lua print) goes to stderr instead.
+     */
+    class BatchServer {
+        int output_fd;
+        std::mutex output_mx;
+
+        std::unique_ptr<EmulatorPool> pool;
+
+        /**
+         * Machine states by name. "boot" is saved once every instance has run
+         * its startup script.
+         */
+        std::mutex states_mx;
+        std::map<std::string, EmulatorPool::Snapshot> states;
+
+        struct Request {
+            std::string id;
+            std::string state;
+            std::string keys;
+            unsigned int settle_frames;
+            uint64_t max_cycles;
+            std::string save;
+        };
+
+        bool ReadFrame(std::vector<uint8_t> &frame);
+        void WriteFrame(const std::string &header, const uint8_t *body, size_t body_size);
+        void WriteError(const std::string &id, const std::string &error);
+        void HandleFrame(const std::vector<uint8_t> &frame);
+        void RunRequest(Emulator &emulator, const Request &request);
+
+    public:
+        BatchServer(std::map<std::string, std::string> argv_map, size_t instances);
+        ~BatchServer();
+        /**
+         * Serve requests until stdin is closed, then wait for the requests in
+         * flight.
+         */
+        void Run();
+    };
+} // namespace casioemu
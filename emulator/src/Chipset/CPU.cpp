@@ -1,13 +1,15 @@
 #include "CPU.hpp"
 
+#include "../Data/StateStream.hpp"
 #include "../Emulator.hpp"
-#include "../Gui/ui.hpp"
+#include "../Gui/CodeViewer.hpp"
 #include "../Logger.hpp"
 #include "Chipset.hpp"
 #include "MMU.hpp"
 
 #include <cstdint>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 
 namespace casioemu {
@@ -230,18 +232,18 @@ namespace casioemu {
         reg_dsr = impl_last_dsr;
     }
 
-    CPU::CPU(Emulator &_emulator) : emulator(_emulator), reg_lr(reg_elr[0]), reg_lcsr(reg_ecsr[0]), reg_psw(reg_epsw[0]) {
-        opcode_dispatch = new OpcodeSource *[0x10000];
-        for (size_t ix = 0; ix != 0x10000; ++ix)
-            opcode_dispatch[ix] = nullptr;
+    CPU::OpcodeSource *CPU::opcode_dispatch[0x10000];
+    std::once_flag CPU::opcode_dispatch_once;
+
+    CPU::CPU(Emulator &_emulator) : emulator(_emulator), reg_lr(reg_elr[0]), reg_lcsr(reg_ecsr[0]), reg_psw(reg_epsw[0]), return_hook(LUA_REFNIL) {
     }
 
     CPU::~CPU() {
-        delete[] opcode_dispatch;
     }
 
     void CPU::SetupInternals() {
-        SetupOpcodeDispatch();
+        // The dispatch table only depends on opcode_sources, so every emulator in the process shares one.
+        std::call_once(opcode_dispatch_once, SetupOpcodeDispatch);
         SetupRegisterProxies();
         impl_csr_mask = emulator.GetModelInfo("csr_mask");
         real_hardware = emulator.GetModelInfo("real_hardware");
@@ -304,36 +306,99 @@ namespace casioemu {
 
         *(CPU **)lua_newuserdata(emulator.lua_state, sizeof(CPU *)) = this;
         lua_newtable(emulator.lua_state);
+
+        /**
+         * Maps every key of `cpu` to what it refers to, so __index and __newindex
+         * get away with a single lookup of an already interned Lua string:
+         * - light userdata: the RegisterStub of an 8 or 16 bit register,
+         * - integer: a wide register, encoded as (size << 4 | first byte register),
+         * - function: a method,
+         * - true: the backtrace.
+         */
+        lua_newtable(emulator.lua_state);
+        for (auto &proxy : register_proxies) {
+            lua_pushlightuserdata(emulator.lua_state, proxy.second);
+            lua_setfield(emulator.lua_state, -2, proxy.first.c_str());
+        }
+        for (size_t size = 2; size <= 8; size <<= 1) {
+            for (size_t rx = 0; rx != 16; rx += size) {
+                std::stringstream ss;
+                ss << (size == 2 ? "er" : size == 4 ? "xr" : "qr") << rx;
+                lua_pushinteger(emulator.lua_state, size << 4 | rx);
+                lua_setfield(emulator.lua_state, -2, ss.str().c_str());
+            }
+        }
+        lua_pushboolean(emulator.lua_state, true);
+        lua_setfield(emulator.lua_state, -2, "bt");
         lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
+            // cpu:get_all() returns a table with the value of every register
             CPU *cpu = *(CPU **)lua_topointer(lua_state, 1);
-            std::string index = lua_tostring(lua_state, 2);
-            if (index == "bt") {
-                lua_pushstring(lua_state, cpu->GetBacktrace().c_str());
-                return 1;
+            lua_createtable(lua_state, 0, cpu->register_proxies.size());
+            for (auto &proxy : cpu->register_proxies) {
+                if (proxy.second->type_size == 1)
+                    lua_pushinteger(lua_state, (uint8_t)proxy.second->raw);
+                else
+                    lua_pushinteger(lua_state, (uint16_t)proxy.second->raw);
+                lua_setfield(lua_state, -2, proxy.first.c_str());
             }
-            auto it = cpu->register_proxies.find(index);
-            if (it == cpu->register_proxies.end())
-                return 0;
-            RegisterStub *reg_stub = it->second;
-            if (reg_stub->type_size == 1)
-                lua_pushinteger(lua_state, (uint8_t)reg_stub->raw);
-            else
-                lua_pushinteger(lua_state, (uint16_t)reg_stub->raw);
             return 1;
         });
-        lua_setfield(emulator.lua_state, -2, "__index");
-        lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
+        lua_setfield(emulator.lua_state, -2, "get_all");
+        lua_pushvalue(emulator.lua_state, -1);
+
+        lua_pushcclosure(emulator.lua_state, [](lua_State *lua_state) {
             CPU *cpu = *(CPU **)lua_topointer(lua_state, 1);
-            auto it = cpu->register_proxies.find(lua_tostring(lua_state, 2));
-            if (it == cpu->register_proxies.end())
+            lua_settop(lua_state, 2);
+            switch (lua_rawget(lua_state, lua_upvalueindex(1))) {
+            case LUA_TLIGHTUSERDATA: {
+                RegisterStub *reg_stub = (RegisterStub *)lua_touserdata(lua_state, -1);
+                if (reg_stub->type_size == 1)
+                    lua_pushinteger(lua_state, (uint8_t)reg_stub->raw);
+                else
+                    lua_pushinteger(lua_state, (uint16_t)reg_stub->raw);
+                return 1;
+            }
+            case LUA_TNUMBER: {
+                size_t code = lua_tointeger(lua_state, -1);
+                uint64_t value = 0;
+                for (size_t bx = 0; bx != code >> 4; ++bx)
+                    value |= (uint64_t)(uint8_t)cpu->reg_r[(code & 0xF) + bx].raw << (bx * 8);
+                lua_pushinteger(lua_state, value);
+                return 1;
+            }
+            case LUA_TFUNCTION:
+                return 1;
+            case LUA_TBOOLEAN:
+                lua_pushstring(lua_state, cpu->GetBacktrace().c_str());
+                return 1;
+            default:
                 return 0;
-            RegisterStub *reg_stub = it->second;
-            if (reg_stub->type_size == 1)
-                reg_stub->raw = (uint8_t)lua_tointeger(lua_state, 3);
-            else
-                reg_stub->raw = (uint16_t)lua_tointeger(lua_state, 3);
-            return 0;
-        });
+            }
+        }, 1);
+        lua_setfield(emulator.lua_state, -3, "__index");
+        lua_pushcclosure(emulator.lua_state, [](lua_State *lua_state) {
+            CPU *cpu = *(CPU **)lua_topointer(lua_state, 1);
+            lua_Integer value = lua_tointeger(lua_state, 3);
+            lua_settop(lua_state, 2);
+            switch (lua_rawget(lua_state, lua_upvalueindex(1))) {
+            case LUA_TLIGHTUSERDATA: {
+                RegisterStub *reg_stub = (RegisterStub *)lua_touserdata(lua_state, -1);
+                if (reg_stub->type_size == 1)
+                    reg_stub->raw = (uint8_t)value;
+                else
+                    reg_stub->raw = (uint16_t)value;
+                return 0;
+            }
+            case LUA_TNUMBER: {
+                size_t code = lua_tointeger(lua_state, -1);
+                for (size_t bx = 0; bx != code >> 4; ++bx)
+                    cpu->reg_r[(code & 0xF) + bx].raw = (uint8_t)((uint64_t)value >> (bx * 8));
+                return 0;
+            }
+            default:
+                return 0;
+            }
+        }, 1);
         lua_setfield(emulator.lua_state, -2, "__newindex");
         lua_setmetatable(emulator.lua_state, -2);
         lua_setglobal(emulator.lua_state, "cpu");
@@ -361,6 +426,12 @@ namespace casioemu {
          */
         reg_dsr = 0;
 
+        if (!native_instruction_hooks.empty() && !emulator.speculating) {
+            uint32_t real_pc = GetCurrentRealPC();
+            for (auto &hook : native_instruction_hooks)
+                hook.first(hook.second, real_pc);
+        }
+
         while (1) {
             impl_opcode = Fetch();
             OpcodeSource *handler = opcode_dispatch[impl_opcode];
@@ -408,7 +479,7 @@ namespace casioemu {
             // [ o ] DSR<-...
             // [ > ] ... <--- this line is not highlighted
             // [ o ] ... <--- this line is highlighted instead
-            if (code_viewer) {
+            if (CodeViewer *code_viewer = emulator.speculating ? nullptr : emulator.code_viewer.load()) {
                 if ((code_viewer->debug_flags & DEBUG_BREAKPOINT) && code_viewer->TryTrigBP(reg_csr, reg_pc)) {
                     emulator.SetPaused(true);
                 } else if ((code_viewer->debug_flags & DEBUG_STEP) && code_viewer->TryTrigBP(reg_csr, reg_pc, false)) {
@@ -419,6 +490,106 @@ namespace casioemu {
             if (!(handler->hint & H_DS))
                 break;
         }
+
+        if (!pc_hook_bitmap.empty() && !emulator.speculating)
+            CheckPCHook();
+    }
+
+    void CPU::AddNativeInstructionHook(NativeInstructionHook hook, void *userdata) {
+        native_instruction_hooks.emplace_back(hook, userdata);
+    }
+
+    bool CPU::CheckPCHook() {
+        size_t real_pc = GetCurrentRealPC();
+        if (!(pc_hook_bitmap[real_pc >> 4] & (1 << ((real_pc >> 1) & 7))))
+            return false;
+        bool breakpoint = !breakpoints.empty() && breakpoints.count(real_pc);
+        if (breakpoint)
+            emulator.SetPaused(true);
+        auto it = pc_hooks.find(real_pc);
+        if (it != pc_hooks.end())
+            CallHook(it->second, "PC", real_pc, 0);
+        return breakpoint;
+    }
+
+    bool CPU::CheckEntryPCHook() {
+        return !pc_hook_bitmap.empty() && !emulator.speculating && CheckPCHook();
+    }
+
+    void CPU::CheckCallHook() {
+        if (call_hooks.empty() || emulator.speculating)
+            return;
+        size_t real_pc = GetCurrentRealPC();
+        auto it = call_hooks.find(real_pc);
+        if (it != call_hooks.end())
+            CallHook(it->second, "call", real_pc, (((size_t)reg_lcsr.raw) << 16) | reg_lr.raw);
+    }
+
+    void CPU::CheckReturnHook() {
+        if (return_hook != LUA_REFNIL && !emulator.speculating)
+            CallHook(return_hook, "return", GetCurrentRealPC(), 0);
+    }
+
+    void CPU::CallHook(int function_ref, const char *kind, size_t real_pc, size_t argument) {
+        lua_State *lua_state = emulator.lua_state;
+        lua_geti(lua_state, LUA_REGISTRYINDEX, function_ref);
+        lua_pushinteger(lua_state, real_pc);
+        lua_pushinteger(lua_state, argument);
+        if (lua_pcall(lua_state, 2, 0, 0) != LUA_OK) {
+            logger::Info("calling %s hook at %06zX failed: %s\n", kind, real_pc, lua_tostring(lua_state, -1));
+            lua_pop(lua_state, 1);
+        }
+    }
+
+    void CPU::SetHook(std::unordered_map<size_t, int> &hooks, size_t real_pc, int function_ref) {
+        auto it = hooks.find(real_pc);
+        if (it != hooks.end()) {
+            luaL_unref(emulator.lua_state, LUA_REGISTRYINDEX, it->second);
+            hooks.erase(it);
+        }
+        if (function_ref != LUA_REFNIL)
+            hooks[real_pc] = function_ref;
+    }
+
+    void CPU::SetPCHook(size_t real_pc, int function_ref) {
+        real_pc &= 0xFFFFE;
+        SetHook(pc_hooks, real_pc, function_ref);
+        UpdatePCHookBitmap(real_pc);
+    }
+
+    void CPU::SetBreakpoint(size_t real_pc, bool enabled) {
+        real_pc &= 0xFFFFE;
+        if (enabled)
+            breakpoints.insert(real_pc);
+        else
+            breakpoints.erase(real_pc);
+        UpdatePCHookBitmap(real_pc);
+    }
+
+    bool CPU::HasBreakpoint(size_t real_pc) {
+        return breakpoints.count(real_pc & 0xFFFFE);
+    }
+
+    void CPU::UpdatePCHookBitmap(size_t real_pc) {
+        if (pc_hooks.empty() && breakpoints.empty()) {
+            pc_hook_bitmap.clear();
+            return;
+        }
+        if (pc_hook_bitmap.empty())
+            pc_hook_bitmap.resize(0x100000 >> 4);
+        if (pc_hooks.count(real_pc) || breakpoints.count(real_pc))
+            pc_hook_bitmap[real_pc >> 4] |= 1 << ((real_pc >> 1) & 7);
+        else
+            pc_hook_bitmap[real_pc >> 4] &= ~(1 << ((real_pc >> 1) & 7));
+    }
+
+    void CPU::SetCallHook(size_t real_pc, int function_ref) {
+        SetHook(call_hooks, real_pc & 0xFFFFE, function_ref);
+    }
+
+    void CPU::SetReturnHook(int function_ref) {
+        luaL_unref(emulator.lua_state, LUA_REGISTRYINDEX, return_hook);
+        return_hook = function_ref;
     }
 
     void CPU::SetMemoryModel(MemoryModel _memory_model) {
@@ -480,4 +651,56 @@ namespace casioemu {
     void CPU::SetDSR(uint8_t dsr) {
         impl_last_dsr = dsr;
     }
+
+    void CPU::SaveState(StateWriter &writer) {
+        for (auto &reg : reg_r)
+            writer.Write(reg.raw);
+        for (auto &reg : reg_cr)
+            writer.Write(reg.raw);
+        for (size_t ix = 0; ix != 4; ++ix) {
+            writer.Write(reg_elr[ix].raw);
+            writer.Write(reg_ecsr[ix].raw);
+            writer.Write(reg_epsw[ix].raw);
+        }
+        writer.Write(reg_pc.raw);
+        writer.Write(reg_csr.raw);
+        writer.Write(reg_sp.raw);
+        writer.Write(reg_ea.raw);
+        writer.Write(reg_dsr.raw);
+        writer.Write(impl_last_dsr);
+        writer.Write(memory_model);
+
+        uint32_t stack_size = stack.size();
+        writer.Write(stack_size);
+        for (auto &frame : stack)
+            writer.Write(frame);
+    }
+
+    void CPU::LoadState(StateReader &reader) {
+        for (auto &reg : reg_r)
+            reader.Read(reg.raw);
+        for (auto &reg : reg_cr)
+            reader.Read(reg.raw);
+        for (size_t ix = 0; ix != 4; ++ix) {
+            reader.Read(reg_elr[ix].raw);
+            reader.Read(reg_ecsr[ix].raw);
+            reader.Read(reg_epsw[ix].raw);
+        }
+        reader.Read(reg_pc.raw);
+        reader.Read(reg_csr.raw);
+        reader.Read(reg_sp.raw);
+        reader.Read(reg_ea.raw);
+        reader.Read(reg_dsr.raw);
+        reader.Read(impl_last_dsr);
+        reader.ReadEnum(memory_model, MM_LARGE);
+
+        uint32_t stack_size;
+        reader.Read(stack_size);
+        stack.clear();
+        for (uint32_t ix = 0; ix != stack_size && !reader.Failed(); ++ix) {
+            StackFrame frame;
+            reader.Read(frame);
+            stack.push_back(frame);
+        }
+    }
 } // namespace casioemu
@@ -5,11 +5,17 @@
 
 #include <cstdint>
 #include <map>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 namespace casioemu {
     class Emulator;
+    class StateWriter;
+    class StateReader;
 
     class CPU {
         Emulator &emulator;
@@ -67,7 +73,7 @@ namespace casioemu {
 
         bool real_hardware;
 
-        void SetupOpcodeDispatch();
+        static void SetupOpcodeDispatch();
         void SetupRegisterProxies();
 
     public:
@@ -111,11 +117,44 @@ namespace casioemu {
         void Next();
         void Reset();
         void Raise(size_t exception_level, size_t index);
+        /**
+         * Run the PC hooks and breakpoints at the current PC after something
+         * other than an instruction, i.e. an interrupt or reset, moved it there.
+         * Returns true if a breakpoint is there, in which case the instruction
+         * must not run before the emulator is resumed.
+         */
+        bool CheckEntryPCHook();
         size_t GetExceptionLevel();
         bool GetMasterInterruptEnable();
         std::string GetBacktrace() const;
         uint8_t GetDSR() const;
         void SetDSR(uint8_t);
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
+
+        /**
+         * Lua hooks run when the CPU reaches an address, when BL calls an address,
+         * or when any function returns. (function_ref) is a Lua registry
+         * reference that the CPU takes ownership of. Pass LUA_REFNIL to remove a
+         * hook.
+         */
+        void SetPCHook(size_t real_pc, int function_ref);
+        void SetCallHook(size_t real_pc, int function_ref);
+        void SetReturnHook(int function_ref);
+
+        /**
+         * Native hooks run before every instruction with its real PC. Unlike the
+         * Lua hooks above, these cannot be removed.
+         */
+        typedef void (*NativeInstructionHook)(void *userdata, uint32_t real_pc);
+        void AddNativeInstructionHook(NativeInstructionHook hook, void *userdata);
+        /**
+         * Pause the emulator when the CPU reaches (real_pc), before the
+         * instruction there runs. Shares the bitmap test with PC hooks, so
+         * breakpoints cost nothing at other addresses.
+         */
+        void SetBreakpoint(size_t real_pc, bool enabled);
+        bool HasBreakpoint(size_t real_pc);
 
     private:
         struct StackFrame {
@@ -124,6 +163,23 @@ namespace casioemu {
         };
         std::vector<StackFrame> stack;
 
+        /**
+         * One bit per even address of the 20-bit code space, set where a PC hook
+         * or a breakpoint is installed, so that instructions without one only
+         * cost a bit test. Empty while there are neither.
+         */
+        std::vector<uint8_t> pc_hook_bitmap;
+        std::unordered_map<size_t, int> pc_hooks, call_hooks;
+        std::unordered_set<size_t> breakpoints;
+        void UpdatePCHookBitmap(size_t real_pc);
+        int return_hook;
+        std::vector<std::pair<NativeInstructionHook, void *>> native_instruction_hooks;
+        void CallHook(int function_ref, const char *kind, size_t real_pc, size_t argument);
+        void SetHook(std::unordered_map<size_t, int> &hooks, size_t real_pc, int function_ref);
+        bool CheckPCHook();
+        void CheckCallHook();
+        void CheckReturnHook();
+
         uint16_t Fetch();
 
         enum OpcodeHint {
@@ -156,7 +212,8 @@ namespace casioemu {
             } operands[2];
         };
         static OpcodeSource opcode_sources[];
-        OpcodeSource **opcode_dispatch;
+        static OpcodeSource *opcode_dispatch[0x10000];
+        static std::once_flag opcode_dispatch_once;
 
         typedef RegisterStub CPU::*RegisterStubPointer;
         typedef RegisterStub (CPU::*RegisterStubArrayPointer)[];
@@ -4,7 +4,7 @@
 #include "Chipset.hpp"
 #include "MMU.hpp"
 
-#include "../Gui/ui.hpp"
+#include "../Gui/CodeViewer.hpp"
 namespace casioemu {
     // * Control Register Access Instructions
     void CPU::OP_ADDSP() {
@@ -196,6 +196,7 @@ namespace casioemu {
                          ((size_t)reg_csr.raw) << 16 | reg_pc.raw);
         OP_B();
         stack.push_back({false, 0, reg_csr, reg_pc});
+        CheckCallHook();
     }
 
     // * Miscellaneous Instructions
@@ -211,7 +212,8 @@ namespace casioemu {
         }
         reg_csr = reg_lcsr;
         reg_pc = reg_lr;
-        if (code_viewer) {
+        CheckReturnHook();
+        if (CodeViewer *code_viewer = emulator.speculating ? nullptr : emulator.code_viewer.load()) {
             if ((code_viewer->debug_flags & DEBUG_RET_TRACE) && code_viewer->TryTrigBP(reg_csr, reg_pc, false)) {
                 emulator.SetPaused(true);
             }
@@ -4,7 +4,7 @@
 #include "Chipset.hpp"
 #include "MMU.hpp"
 
-#include "../Gui/ui.hpp"
+#include "../Gui/CodeViewer.hpp"
 
 namespace casioemu {
     // * PUSH/POP Instructions
@@ -84,7 +84,8 @@ namespace casioemu {
                 reg_csr = Pop16() & 0x000F;
             if (!stack.empty() && stack.back().lr_pushed && stack.back().lr_push_address == oldsp)
                 stack.pop_back();
-            if (code_viewer) {
+            CheckReturnHook();
+            if (CodeViewer *code_viewer = emulator.speculating ? nullptr : emulator.code_viewer.load()) {
                 if ((code_viewer->debug_flags & DEBUG_RET_TRACE) && code_viewer->TryTrigBP(reg_csr, reg_pc, false)) {
                     emulator.SetPaused(true);
                 }
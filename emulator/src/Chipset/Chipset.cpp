@@ -1,6 +1,8 @@
 #include "Chipset.hpp"
 
 #include "../Data/HardwareId.hpp"
+#include "../Data/MappedFile.hpp"
+#include "../Data/StateStream.hpp"
 #include "../Emulator.hpp"
 #include "../Logger.hpp"
 #include "CPU.hpp"
@@ -18,9 +20,30 @@
 
 #include <algorithm>
 #include <cstring>
-#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
 
 namespace casioemu {
+    /**
+     * Maps the ROM file at (path). A mapping stays cached for as long as at
+     * least one chipset is still using it.
+     */
+    static std::shared_ptr<const MappedFile> LoadROMImage(const std::string &path) {
+        static std::mutex cache_mx;
+        static std::map<std::string, std::weak_ptr<const MappedFile>> cache;
+
+        std::lock_guard<std::mutex> cache_lock(cache_mx);
+        if (auto image = cache[path].lock())
+            return image;
+
+        auto image = std::make_shared<MappedFile>();
+        if (!image->Open(path, MappedFile::MF_READ_ONLY))
+            PANIC("failed to map ROM file %s\n", path.c_str());
+        cache[path] = image;
+        return image;
+    }
+
     Chipset::Chipset(Emulator &_emulator) : emulator(_emulator), cpu(*new CPU(emulator)), mmu(*new MMU(emulator)) {
     }
 
@@ -58,9 +81,9 @@ namespace casioemu {
 
     void Chipset::ConstructPeripherals() {
         peripherals.push_front(new ROMWindow(emulator));
-        peripherals.push_front(new BatteryBackedRAM(emulator));
-        peripherals.push_front(CreateScreen(emulator));
-        peripherals.push_front(new Keyboard(emulator));
+        peripherals.push_front(battery_backed_ram = new BatteryBackedRAM(emulator));
+        peripherals.push_front(screen = CreateScreen(emulator));
+        peripherals.push_front(keyboard = new Keyboard(emulator));
         peripherals.push_front(new StandbyControl(emulator));
         peripherals.push_front(new Miscellaneous(emulator));
         peripherals.push_front(new Timer(emulator));
@@ -74,10 +97,9 @@ namespace casioemu {
     }
 
     void Chipset::SetupInternals() {
-        std::ifstream rom_handle(emulator.GetModelFilePath(emulator.GetModelInfo("rom_path")), std::ifstream::binary);
-        if (rom_handle.fail())
-            PANIC("std::ifstream failed: %s\n", std::strerror(errno));
-        rom_data = std::vector<unsigned char>((std::istreambuf_iterator<char>(rom_handle)), std::istreambuf_iterator<char>());
+        rom_image = LoadROMImage(emulator.GetModelFilePath(emulator.GetModelInfo("rom_path")));
+        rom_data = rom_image->GetData();
+        rom_size = rom_image->GetSize();
 
         for (auto &peripheral : peripherals)
             peripheral->Initialise();
@@ -120,10 +142,12 @@ namespace casioemu {
 
     void Chipset::Halt() {
         run_mode = RM_HALT;
+        emulator.events.Emit(EV_HALT, RM_HALT);
     }
 
     void Chipset::Stop() {
         run_mode = RM_STOP;
+        emulator.events.Emit(EV_HALT, RM_STOP);
     }
 
     void Chipset::RaiseEmulator() {
@@ -157,8 +181,9 @@ namespace casioemu {
         pending_interrupt_count++;
     }
 
-    void Chipset::AcceptInterrupt() {
+    bool Chipset::AcceptInterrupt() {
         size_t old_exception_level = cpu.GetExceptionLevel();
+        bool at_breakpoint = false;
 
         size_t index = 0;
         // * Reset has priority over everything.
@@ -209,19 +234,25 @@ namespace casioemu {
         if (index >= INT_MASKABLE && index < INT_SOFTWARE) {
             if (InterruptEnabledBySFR(index)) {
                 SetInterruptPendingSFR(index);
-                if (cpu.GetMasterInterruptEnable())
+                if (cpu.GetMasterInterruptEnable()) {
                     cpu.Raise(exception_level, index);
+                    emulator.events.Emit(EV_INTERRUPT, index);
+                    at_breakpoint = cpu.CheckEntryPCHook();
+                }
             }
         } else if (index) {
             cpu.Raise(exception_level, index);
+            emulator.events.Emit(EV_INTERRUPT, index);
+            at_breakpoint = cpu.CheckEntryPCHook();
         }
 
         run_mode = RM_RUN;
 
         // * TODO: introduce delay
-        if (!index) return;
+        if (!index) return false;
         interrupts_active[index] = false;
         pending_interrupt_count--;
+        return at_breakpoint;
     }
 
     bool Chipset::InterruptEnabledBySFR(size_t index) {
@@ -242,9 +273,15 @@ namespace casioemu {
         });
     }
 
-    void Chipset::Frame() {
+    void Chipset::PublishFrame() {
         for (auto peripheral : peripherals)
-            peripheral->Frame();
+            if (peripheral->GetRequireFrame())
+                peripheral->PublishFrame();
+    }
+
+    void Chipset::Frame(bool redraw_all) {
+        for (auto peripheral : peripherals)
+            peripheral->Frame(redraw_all);
     }
 
     void Chipset::Tick() {
@@ -253,13 +290,15 @@ namespace casioemu {
         for (auto peripheral : peripherals)
             peripheral->Tick();
 
+        // The PC hooks and breakpoints of the handler's first instruction are checked right after it's entered.
+        bool at_breakpoint = false;
         if (pending_interrupt_count)
-            AcceptInterrupt();
+            at_breakpoint = AcceptInterrupt();
 
         for (auto peripheral : peripherals)
             peripheral->TickAfterInterrupts();
 
-        if (run_mode == RM_RUN)
+        if (run_mode == RM_RUN && !at_breakpoint)
             cpu.Next();
     }
 
@@ -267,4 +306,28 @@ namespace casioemu {
         for (auto peripheral : peripherals)
             peripheral->UIEvent(event);
     }
+
+    void Chipset::SaveState(StateWriter &writer) {
+        writer.Write(run_mode);
+        writer.Write(pending_interrupt_count);
+        writer.Write(interrupts_active);
+        writer.Write(data_int_mask);
+        writer.Write(data_int_pending);
+
+        cpu.SaveState(writer);
+        for (auto peripheral : peripherals)
+            peripheral->SaveState(writer);
+    }
+
+    void Chipset::LoadState(StateReader &reader) {
+        reader.ReadEnum(run_mode, RM_RUN);
+        reader.Read(pending_interrupt_count);
+        reader.Read(interrupts_active);
+        reader.Read(data_int_mask);
+        reader.Read(data_int_pending);
+
+        cpu.LoadState(reader);
+        for (auto peripheral : peripherals)
+            peripheral->LoadState(reader);
+    }
 } // namespace casioemu
@@ -5,6 +5,7 @@
 
 #include <SDL.h>
 #include <forward_list>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -13,6 +14,12 @@ namespace casioemu {
     class CPU;
     class MMU;
     class Peripheral;
+    class ScreenBase;
+    class Keyboard;
+    class BatteryBackedRAM;
+    class MappedFile;
+    class StateWriter;
+    class StateReader;
 
     class Chipset {
         enum InterruptIndex {
@@ -33,7 +40,10 @@ namespace casioemu {
          */
         size_t pending_interrupt_count;
         bool interrupts_active[INT_COUNT];
-        void AcceptInterrupt();
+        /**
+         * Returns true if the CPU entered the handler at a breakpoint.
+         */
+        bool AcceptInterrupt();
         void RaiseSoftware(size_t index);
 
         void ConstructPeripherals();
@@ -61,7 +71,22 @@ namespace casioemu {
         Emulator &emulator;
         CPU &cpu;
         MMU &mmu;
-        std::vector<unsigned char> rom_data;
+        /**
+         * ROM images are mapped read-only, so emulators running the same model
+         * share one copy. See LoadROMImage in Chipset.cpp. (rom_data) and
+         * (rom_size) point into (rom_image).
+         */
+        std::shared_ptr<const MappedFile> rom_image;
+        const uint8_t *rom_data;
+        size_t rom_size;
+
+        /**
+         * Peripherals that are accessed directly from outside of the chipset.
+         * These are owned by (peripherals).
+         */
+        ScreenBase *screen;
+        BatteryBackedRAM *battery_backed_ram;
+        Keyboard *keyboard;
 
         /**
          * This exists because the Emulator that owns this Chipset is not ready
@@ -86,9 +111,23 @@ namespace casioemu {
 
         void Tick();
         bool GetRequireFrame();
-        void Frame();
+        /**
+         * Call PublishFrame() on the peripherals that require it.
+         */
+        void PublishFrame();
+        /**
+         * Call Frame() on every peripheral. Does not need (access_mx).
+         */
+        void Frame(bool redraw_all);
         void UIEvent(SDL_Event &event);
 
+        /**
+         * Save or restore the state of the CPU, the interrupt controller and all
+         * peripherals. Watchpoints live in the Lua state and are not included.
+         */
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
+
         friend class CPU;
     };
 } // namespace casioemu
@@ -1,5 +1,6 @@
 #include "InterruptSource.hpp"
 
+#include "../Data/StateStream.hpp"
 #include "../Emulator.hpp"
 #include "Chipset.hpp"
 
@@ -45,4 +46,12 @@ namespace casioemu {
 
         return raise_success && emulator->chipset.GetInterruptPendingSFR(interrupt_index);
     }
+
+    void InterruptSource::SaveState(StateWriter &writer) {
+        writer.Write(raise_success);
+    }
+
+    void InterruptSource::LoadState(StateReader &reader) {
+        reader.Read(raise_success);
+    }
 } // namespace casioemu
@@ -3,6 +3,8 @@
 
 namespace casioemu {
     class Emulator;
+    class StateWriter;
+    class StateReader;
 
     class InterruptSource {
         Emulator *emulator;
@@ -15,5 +17,7 @@ namespace casioemu {
         bool Enabled();
         bool TryRaise();
         bool Success();
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
     };
 } // namespace casioemu
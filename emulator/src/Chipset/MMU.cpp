@@ -3,6 +3,7 @@
 #include "../Emulator.hpp"
 #include "../Logger.hpp"
 #include "Chipset.hpp"
+#include <algorithm>
 #include <cstring>
 
 
@@ -56,7 +57,110 @@ namespace casioemu {
 
         *(MMU **)lua_newuserdata(emulator.lua_state, sizeof(MMU *)) = this;
         lua_newtable(emulator.lua_state);
+
+        // Methods of `data`, looked up by __index for non-integer keys.
+        lua_newtable(emulator.lua_state);
+        lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
+            // execute Lua function whenever address is read from
+            if (lua_gettop(lua_state) != 3)
+                return luaL_error(lua_state, "rwatch function called with incorrect number of arguments");
+
+            MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
+            size_t offset = lua_tointeger(lua_state, 2);
+            int on_read = luaL_ref(lua_state, LUA_REGISTRYINDEX);
+
+            size_t segment_index = offset >> 16;
+            size_t segment_offset = offset & 0xFFFF;
+
+            MemoryByte *segment = mmu->segment_dispatch[segment_index];
+            if (!segment) {
+                logger::Info("attempt to set rwatch from offset %04zX of unmapped segment %02zX\n",
+                             segment_offset, segment_index);
+                return 0;
+            }
+
+            MemoryByte &byte = segment[segment_offset];
+            luaL_unref(lua_state, LUA_REGISTRYINDEX, byte.on_read);
+            byte.on_read = on_read;
+            return 0;
+        });
+        lua_setfield(emulator.lua_state, -2, "rwatch");
+        lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
+            // execute Lua function whenever address is written to
+            if (lua_gettop(lua_state) != 3)
+                return luaL_error(lua_state, "watch function called with incorrect number of arguments");
+
+            MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
+            size_t offset = lua_tointeger(lua_state, 2);
+            int on_write = luaL_ref(lua_state, LUA_REGISTRYINDEX);
+
+            size_t segment_index = offset >> 16;
+            size_t segment_offset = offset & 0xFFFF;
+
+            MemoryByte *segment = mmu->segment_dispatch[segment_index];
+            if (!segment) {
+                logger::Info("attempt to set watch from offset %04zX of unmapped segment %02zX\n",
+                             segment_offset, segment_index);
+                return 0;
+            }
+
+            MemoryByte &byte = segment[segment_offset];
+            luaL_unref(lua_state, LUA_REGISTRYINDEX, byte.on_write);
+            byte.on_write = on_write;
+            return 0;
+        });
+        lua_setfield(emulator.lua_state, -2, "watch");
+        lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
+            // data:read(offset, size[, raw]) returns the bytes as a string
+            MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
+            size_t offset = luaL_checkinteger(lua_state, 2);
+            size_t size = luaL_checkinteger(lua_state, 3);
+            if (offset >= (1 << 24) || size > (1 << 24) - offset)
+                return luaL_error(lua_state, "data:read range %zX+%zX doesn't fit 24 bits", offset, size);
+            luaL_Buffer buffer;
+            mmu->ReadBlock(offset, (uint8_t *)luaL_buffinitsize(lua_state, &buffer, size), size, lua_toboolean(lua_state, 4));
+            luaL_pushresultsize(&buffer, size);
+            return 1;
+        });
+        lua_setfield(emulator.lua_state, -2, "read");
+        lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
+            // data:write(offset, bytes[, raw])
+            MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
+            size_t offset = luaL_checkinteger(lua_state, 2);
+            size_t size;
+            const char *bytes = luaL_checklstring(lua_state, 3, &size);
+            if (offset >= (1 << 24) || size > (1 << 24) - offset)
+                return luaL_error(lua_state, "data:write range %zX+%zX doesn't fit 24 bits", offset, size);
+            mmu->WriteBlock(offset, (const uint8_t *)bytes, size, lua_toboolean(lua_state, 4));
+            return 0;
+        });
+        lua_setfield(emulator.lua_state, -2, "write");
         lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
+            // data:read_u16(offset[, raw]), little endian
+            MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
+            size_t offset = luaL_checkinteger(lua_state, 2);
+            if (offset >= (1 << 24) - 1)
+                return luaL_error(lua_state, "data:read_u16 offset %zX doesn't fit 24 bits", offset);
+            uint8_t bytes[2];
+            mmu->ReadBlock(offset, bytes, 2, lua_toboolean(lua_state, 3));
+            lua_pushinteger(lua_state, bytes[0] | bytes[1] << 8);
+            return 1;
+        });
+        lua_setfield(emulator.lua_state, -2, "read_u16");
+        lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
+            // data:read_u32(offset[, raw]), little endian
+            MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
+            size_t offset = luaL_checkinteger(lua_state, 2);
+            if (offset >= (1 << 24) - 3)
+                return luaL_error(lua_state, "data:read_u32 offset %zX doesn't fit 24 bits", offset);
+            uint8_t bytes[4];
+            mmu->ReadBlock(offset, bytes, 4, lua_toboolean(lua_state, 3));
+            lua_pushinteger(lua_state, bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24);
+            return 1;
+        });
+        lua_setfield(emulator.lua_state, -2, "read_u32");
+
+        lua_pushcclosure(emulator.lua_state, [](lua_State *lua_state) {
             MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
             int isnum;
             size_t offset = lua_tointegerx(lua_state, 2, &isnum);
@@ -64,65 +168,10 @@ namespace casioemu {
                 lua_pushinteger(lua_state, mmu->ReadData(offset));
                 return 1;
             }
-            const char *key = lua_tostring(lua_state, 2);
-            if (key == nullptr) // the key is not a string
-                return 0;
-            if (std::strcmp(key, "rwatch") == 0) {
-                // execute Lua function whenever address is read from
-                lua_pushcfunction(lua_state, [](lua_State *lua_state) {
-                    if (lua_gettop(lua_state) != 3)
-                        return luaL_error(lua_state, "rwatch function called with incorrect number of arguments");
-
-                    MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
-                    size_t offset = lua_tointeger(lua_state, 2);
-                    int on_read = luaL_ref(lua_state, LUA_REGISTRYINDEX);
-
-                    size_t segment_index = offset >> 16;
-                    size_t segment_offset = offset & 0xFFFF;
-
-                    MemoryByte *segment = mmu->segment_dispatch[segment_index];
-                    if (!segment) {
-                        logger::Info("attempt to set rwatch from offset %04zX of unmapped segment %02zX\n",
-                                     segment_offset, segment_index);
-                        return 0;
-                    }
-
-                    MemoryByte &byte = segment[segment_offset];
-                    luaL_unref(lua_state, LUA_REGISTRYINDEX, byte.on_read);
-                    byte.on_read = on_read;
-                    return 0;
-                });
-                return 1;
-            } else if (std::strcmp(key, "watch") == 0) {
-                // execute Lua function whenever address is written to
-                lua_pushcfunction(lua_state, [](lua_State *lua_state) {
-                    if (lua_gettop(lua_state) != 3)
-                        return luaL_error(lua_state, "watch function called with incorrect number of arguments");
-
-                    MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
-                    size_t offset = lua_tointeger(lua_state, 2);
-                    int on_write = luaL_ref(lua_state, LUA_REGISTRYINDEX);
-
-                    size_t segment_index = offset >> 16;
-                    size_t segment_offset = offset & 0xFFFF;
-
-                    MemoryByte *segment = mmu->segment_dispatch[segment_index];
-                    if (!segment) {
-                        logger::Info("attempt to set watch from offset %04zX of unmapped segment %02zX\n",
-                                     segment_offset, segment_index);
-                        return 0;
-                    }
-
-                    MemoryByte &byte = segment[segment_offset];
-                    luaL_unref(lua_state, LUA_REGISTRYINDEX, byte.on_write);
-                    byte.on_write = on_write;
-                    return 0;
-                });
-                return 1;
-            } else {
-                return 0;
-            }
-        });
+            lua_settop(lua_state, 2);
+            lua_gettable(lua_state, lua_upvalueindex(1));
+            return 1;
+        }, 1);
         lua_setfield(emulator.lua_state, -2, "__index");
         lua_pushcfunction(emulator.lua_state, [](lua_State *lua_state) {
             MMU *mmu = *(MMU **)lua_topointer(lua_state, 1);
@@ -149,14 +198,16 @@ namespace casioemu {
         MemoryByte *segment = segment_dispatch[segment_index];
         if (!segment) {
             if (PRINT_UNMAPPED_MSG) logger::Info("code read from offset %04zX of unmapped segment %02zX\n", segment_offset, segment_index);
-            emulator.HandleMemoryError();
+            if (!unobserved)
+                emulator.HandleMemoryError(offset, false);
             return UNMAPPED_VALUE;
         }
 
         MMURegion *region = segment[segment_offset].region;
         if (!region) {
             if (PRINT_UNMAPPED_MSG) logger::Info("code read from unmapped offset %04zX of segment %02zX\n", segment_offset, segment_index);
-            emulator.HandleMemoryError();
+            if (!unobserved)
+                emulator.HandleMemoryError(offset, false);
             return UNMAPPED_VALUE;
         }
 
@@ -173,13 +224,14 @@ namespace casioemu {
         MemoryByte *segment = segment_dispatch[segment_index];
         if (!segment) {
             if (PRINT_UNMAPPED_MSG) logger::Info("read from offset %04zX of unmapped segment %02zX\n", segment_offset, segment_index);
-            emulator.HandleMemoryError();
+            if (!unobserved)
+                emulator.HandleMemoryError(offset, false);
             return UNMAPPED_VALUE;
         }
 
         MemoryByte &byte = segment[segment_offset];
         MMURegion *region = byte.region;
-        if (byte.on_read != LUA_REFNIL) {
+        if (byte.on_read != LUA_REFNIL && !unobserved && !emulator.speculating) {
             lua_geti(emulator.lua_state, LUA_REGISTRYINDEX, byte.on_read);
             if (lua_pcall(emulator.lua_state, 0, 0, 0) != LUA_OK) {
                 logger::Info("calling commands on rwatch at %06zX failed: %s\n",
@@ -189,11 +241,15 @@ namespace casioemu {
         }
         if (!region) {
             if (PRINT_UNMAPPED_MSG) logger::Info("read from unmapped offset %04zX of segment %02zX\n", segment_offset, segment_index);
-            emulator.HandleMemoryError();
+            if (!unobserved)
+                emulator.HandleMemoryError(offset, false);
             return UNMAPPED_VALUE;
         }
 
-        return region->read(region, offset);
+        uint8_t data = region->read(region, offset);
+        if (!native_watches.empty() && !unobserved && !emulator.speculating)
+            CheckNativeWatches(offset, data, false);
+        return data;
     }
 
     void MMU::WriteData(size_t offset, uint8_t data) {
@@ -206,13 +262,14 @@ namespace casioemu {
         MemoryByte *segment = segment_dispatch[segment_index];
         if (!segment) {
             if (PRINT_UNMAPPED_MSG) logger::Info("write to offset %04zX of unmapped segment %02zX (%02zX)\n", segment_offset, segment_index, data);
-            emulator.HandleMemoryError();
+            if (!unobserved)
+                emulator.HandleMemoryError(offset, true);
             return;
         }
 
         MemoryByte &byte = segment[segment_offset];
         MMURegion *region = byte.region;
-        if (byte.on_write != LUA_REFNIL) {
+        if (byte.on_write != LUA_REFNIL && !unobserved && !emulator.speculating) {
             lua_geti(emulator.lua_state, LUA_REGISTRYINDEX, byte.on_write);
             if (lua_pcall(emulator.lua_state, 0, 0, 0) != LUA_OK) {
                 logger::Info("calling commands on watch at %06zX failed: %s\n",
@@ -222,15 +279,77 @@ namespace casioemu {
         }
         if (!region) {
             if (PRINT_UNMAPPED_MSG) logger::Info("write to unmapped offset %04zX of segment %02zX (%02zX)\n", segment_offset, segment_index, data);
-            emulator.HandleMemoryError();
+            if (!unobserved)
+                emulator.HandleMemoryError(offset, true);
             return;
         }
 
+        if (!native_watches.empty() && !unobserved && !emulator.speculating)
+            CheckNativeWatches(offset, data, true);
         region->write(region, offset, data);
     }
 
+    void MMU::AddNativeWatch(size_t begin, size_t end, NativeWatchFunction on_read, NativeWatchFunction on_write, void *userdata) {
+        native_watches.push_back({begin, end, on_read, on_write, userdata});
+    }
+
+    void MMU::RemoveNativeWatches(void *userdata) {
+        native_watches.erase(std::remove_if(native_watches.begin(), native_watches.end(), [userdata](const NativeWatch &watch) {
+            return watch.userdata == userdata;
+        }), native_watches.end());
+    }
+
+    void MMU::CheckNativeWatches(size_t offset, uint8_t data, bool write) {
+        for (auto &watch : native_watches) {
+            if (offset < watch.begin || offset >= watch.end)
+                continue;
+            NativeWatchFunction function = write ? watch.on_write : watch.on_read;
+            if (function)
+                function(watch.userdata, offset, data);
+        }
+    }
+
+    void MMU::ReadBlock(size_t offset, uint8_t *buffer, size_t size, bool raw) {
+        if (!raw) {
+            for (size_t ix = 0; ix != size; ++ix)
+                buffer[ix] = ReadData(offset + ix);
+            return;
+        }
+
+        while (size) {
+            MemoryByte *segment = segment_dispatch[offset >> 16];
+            MMURegion *region = segment ? segment[offset & 0xFFFF].region : nullptr;
+            size_t count = 1;
+            if (!region)
+                *buffer = UNMAPPED_VALUE;
+            else if (region->direct) {
+                count = std::min(size, region->base + region->size - offset);
+                std::memcpy(buffer, region->direct + (offset - region->base), count);
+            } else
+                *buffer = region->read(region, offset);
+            offset += count;
+            buffer += count;
+            size -= count;
+        }
+    }
+
+    void MMU::WriteBlock(size_t offset, const uint8_t *buffer, size_t size, bool raw) {
+        for (size_t ix = 0; ix != size; ++ix) {
+            if (!raw) {
+                WriteData(offset + ix, buffer[ix]);
+                continue;
+            }
+            MemoryByte *segment = segment_dispatch[(offset + ix) >> 16];
+            MMURegion *region = segment ? segment[(offset + ix) & 0xFFFF].region : nullptr;
+            if (region)
+                region->write(region, offset + ix, buffer[ix]);
+        }
+    }
+
     void MMU::RegisterRegion(MMURegion *region) {
         for (size_t ix = region->base; ix != region->base + region->size; ++ix) {
+            if (!segment_dispatch[ix >> 16])
+                GenerateSegmentDispatch(ix >> 16);
             if (segment_dispatch[ix >> 16][ix & 0xFFFF].region)
                 PANIC("MMU region overlap at %06zX\n", ix);
             segment_dispatch[ix >> 16][ix & 0xFFFF].region = region;
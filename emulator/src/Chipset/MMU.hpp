@@ -5,6 +5,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 namespace casioemu {
     class Emulator;
@@ -24,6 +25,28 @@ namespace casioemu {
         MemoryByte **segment_dispatch;
 
     public:
+        typedef void (*NativeWatchFunction)(void *userdata, uint32_t offset, uint8_t data);
+
+    private:
+        struct NativeWatch {
+            size_t begin, end;
+            NativeWatchFunction on_read, on_write;
+            void *userdata;
+        };
+        /**
+         * Checked on every data access, but only while it is not empty.
+         */
+        std::vector<NativeWatch> native_watches;
+        void CheckNativeWatches(size_t offset, uint8_t data, bool write);
+
+    public:
+        /**
+         * While set, ReadCode, ReadData and WriteData neither trigger
+         * watchpoints nor report memory errors. Set around accesses that
+         * aren't the guest's own, like the GDB stub serving its client.
+         */
+        bool unobserved = false;
+
         MMU(Emulator &emulator);
         ~MMU();
         void SetupInternals();
@@ -31,6 +54,26 @@ namespace casioemu {
         uint16_t ReadCode(size_t offset);
         uint8_t ReadData(size_t offset);
         void WriteData(size_t offset, uint8_t data);
+        /**
+         * Copy a range of data memory. If (raw) is set, watchpoints are not
+         * triggered, memory errors are not reported and regions that have a
+         * (direct) buffer are copied with memcpy. Otherwise this is the same
+         * as calling ReadData/WriteData for every byte.
+         */
+        void ReadBlock(size_t offset, uint8_t *buffer, size_t size, bool raw);
+        void WriteBlock(size_t offset, const uint8_t *buffer, size_t size, bool raw);
+
+        /**
+         * Call (on_read) with every byte read as data from [begin, end), and
+         * (on_write) with every byte about to be written to it. Either may be
+         * null.
+         */
+        void AddNativeWatch(size_t begin, size_t end, NativeWatchFunction on_read, NativeWatchFunction on_write, void *userdata);
+        /**
+         * Remove every native watch added with (userdata). Must not be called
+         * from a watch function.
+         */
+        void RemoveNativeWatches(void *userdata);
 
         void RegisterRegion(MMURegion *region);
         void UnregisterRegion(MMURegion *region);
@@ -23,6 +23,7 @@ namespace casioemu {
         size = _size;
         description = _description;
         userdata = _userdata;
+        direct = nullptr;
         read = _read;
         write = _write;
 
@@ -16,6 +16,11 @@ namespace casioemu {
         size_t base, size;
         std::string description;
         void *userdata;
+        /**
+         * If not null, reading byte (offset) of this region always yields
+         * direct[offset - base], so bulk reads may bypass (read). Set after Setup().
+         */
+        const uint8_t *direct;
         ReadFunction read;
         WriteFunction write;
         bool setup_done;
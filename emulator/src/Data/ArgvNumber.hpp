@@ -0,0 +1,32 @@
+#pragma once
+#include "../Config.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+namespace casioemu {
+    /**
+     * Parse (value), given for the command line key (key), as an integer
+     * between (min) and (max). Accepts the prefixes of std::stoull with base 0
+     * ("0x1F", "017"). PANICs with a message naming (key) on anything else.
+     */
+    inline unsigned long long ParseArgvNumber(const std::string &key, const std::string &value, unsigned long long min, unsigned long long max) {
+        unsigned long long number = 0;
+        std::size_t pos = 0;
+        try {
+            // std::stoull would accept negative numbers and wrap them around.
+            if (value.find('-') == std::string::npos)
+                number = std::stoull(value, &pos, 0);
+        } catch (std::invalid_argument const &) {
+            pos = 0;
+        } catch (std::out_of_range const &) {
+            PANIC("out of range %s parameter\n", key.c_str());
+        }
+        if (!pos || pos != value.size())
+            PANIC("invalid %s parameter\n", key.c_str());
+        if (number < min || number > max)
+            PANIC("%s must be between %llu and %llu\n", key.c_str(), min, max);
+        return number;
+    }
+} // namespace casioemu
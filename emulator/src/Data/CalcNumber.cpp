@@ -0,0 +1,66 @@
+#include "CalcNumber.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace casioemu {
+    bool DecodeCalcNumber(const uint8_t *bytes, double &value) {
+        uint8_t flags = bytes[9];
+        if ((flags != 0 && flags != 1 && flags != 5 && flags != 6) || bytes[0] > 9)
+            return false;
+
+        unsigned long long mantissa = bytes[0];
+        for (int ix = 1; ix != 8; ++ix) {
+            if ((bytes[ix] >> 4) > 9 || (bytes[ix] & 0xF) > 9)
+                return false;
+            mantissa = mantissa * 100 + (bytes[ix] >> 4) * 10 + (bytes[ix] & 0xF);
+        }
+        if ((bytes[8] >> 4) > 9 || (bytes[8] & 0xF) > 9)
+            return false;
+        int exponent = (bytes[8] >> 4) * 10 + (bytes[8] & 0xF);
+        if (flags == 0 || flags == 5)
+            exponent -= 100;
+
+        // The mantissa is exact in a double, so let strtod do the correctly rounded scaling.
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%llue%d", mantissa, exponent - 14);
+        value = std::strtod(buffer, nullptr);
+        if (flags >= 5)
+            value = -value;
+        return true;
+    }
+
+    bool EncodeCalcNumber(double value, uint8_t *bytes) {
+        if (!std::isfinite(value))
+            return false;
+        std::memset(bytes, 0, CALC_NUMBER_SIZE);
+        if (value == 0)
+            return true;
+
+        // "d.dddddddddddddde+x", 15 significant digits.
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.14e", std::fabs(value));
+        int exponent = std::atoi(buffer + 17);
+        if (exponent >= 100)
+            return false;
+        if (exponent < -99)
+            return true;
+
+        char digits[15];
+        digits[0] = buffer[0] - '0';
+        for (int ix = 1; ix != 15; ++ix)
+            digits[ix] = buffer[ix + 1] - '0';
+        bytes[0] = digits[0];
+        for (int ix = 1; ix != 8; ++ix)
+            bytes[ix] = digits[ix * 2 - 1] << 4 | digits[ix * 2];
+
+        bool negative_exponent = exponent < 0;
+        if (negative_exponent)
+            exponent += 100;
+        bytes[8] = (exponent / 10) << 4 | (exponent % 10);
+        bytes[9] = (negative_exponent ? 0 : 1) + (value < 0 ? 5 : 0);
+        return true;
+    }
+} // namespace casioemu
@@ -0,0 +1,28 @@
+#pragma once
+#include "../Config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace casioemu {
+    /**
+     * The calculator's decimal floating-point format, as stored in variables:
+     * 15 BCD digits of mantissa (the first one in the low nibble of byte 0,
+     * two per byte up to byte 7), a 2-digit BCD exponent in byte 8 and a flag
+     * byte: 0 or 5 if the exponent is negative (biased by 100), 1 or 6 if it
+     * isn't, where 5 and 6 mark negative numbers. Zero is all zero bytes.
+     */
+    static const size_t CALC_NUMBER_SIZE = 10;
+
+    /**
+     * Returns false if (bytes) isn't a valid number, e.g. if it has a digit
+     * above 9.
+     */
+    bool DecodeCalcNumber(const uint8_t *bytes, double &value);
+    /**
+     * Rounds (value) to 15 significant digits. Returns false if the result is
+     * out of range (at least 1e100) or isn't finite. Numbers too small to
+     * represent become zero.
+     */
+    bool EncodeCalcNumber(double value, uint8_t *bytes);
+} // namespace casioemu
@@ -0,0 +1,47 @@
+#pragma once
+#include "../Config.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace casioemu {
+    /**
+     * A copy of the machine state taken by the emulation thread at the end of a
+     * timer slice. The debugger GUI only ever reads from one of these, so it never
+     * observes registers or memory halfway through an instruction.
+     */
+    struct DebugState {
+        uint64_t sequence;
+        bool paused;
+        int run_mode;
+
+        // As in CPU, index 0 of the exception register arrays holds LR, LCSR and PSW.
+        uint8_t reg_r[16], reg_epsw[4];
+        uint16_t reg_pc, reg_csr, reg_sp, reg_ea;
+        uint16_t reg_elr[4], reg_ecsr[4];
+        std::string backtrace;
+
+        size_t ram_base;
+        std::vector<uint8_t> ram;
+        std::vector<uint8_t> lcd;
+
+        // From Emulator::SpeedStats.
+        double speed;
+        uint64_t dropped_cycles;
+        unsigned int skipped_frames;
+
+        /**
+         * True if everything but (sequence) is equal.
+         */
+        bool SameMachineState(const DebugState &other) const {
+            return paused == other.paused && run_mode == other.run_mode &&
+                   !std::memcmp(reg_r, other.reg_r, sizeof(reg_r)) && !std::memcmp(reg_epsw, other.reg_epsw, sizeof(reg_epsw)) &&
+                   reg_pc == other.reg_pc && reg_csr == other.reg_csr && reg_sp == other.reg_sp && reg_ea == other.reg_ea &&
+                   !std::memcmp(reg_elr, other.reg_elr, sizeof(reg_elr)) && !std::memcmp(reg_ecsr, other.reg_ecsr, sizeof(reg_ecsr)) &&
+                   backtrace == other.backtrace && ram_base == other.ram_base && ram == other.ram && lcd == other.lcd &&
+                   speed == other.speed && dropped_cycles == other.dropped_cycles && skipped_frames == other.skipped_frames;
+        }
+    };
+} // namespace casioemu
@@ -0,0 +1,100 @@
+#include "GlyphMatcher.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace casioemu {
+    GlyphMatcher::GlyphMatcher(unsigned int _height, unsigned int _space_width) : height(_height), space_width(_space_width) {
+    }
+
+    unsigned int GlyphMatcher::GetHeight() const {
+        return height;
+    }
+
+    bool GlyphMatcher::AddGlyph(const std::string &text, const std::vector<std::string> &rows) {
+        if (!height || height > MAX_HEIGHT || rows.size() != height)
+            return false;
+        size_t width = rows[0].size();
+        for (auto &row : rows)
+            if (row.size() != width)
+                return false;
+
+        Glyph glyph;
+        glyph.text = text;
+        glyph.columns.resize(width);
+        for (size_t iy = 0; iy != height; ++iy)
+            for (size_t ix = 0; ix != width; ++ix)
+                if (rows[iy][ix] != ' ' && rows[iy][ix] != '.')
+                    glyph.columns[ix] |= (uint64_t)1 << iy;
+
+        while (!glyph.columns.empty() && !glyph.columns.back())
+            glyph.columns.pop_back();
+        auto first = std::find_if(glyph.columns.begin(), glyph.columns.end(), [](uint64_t column) {
+            return column != 0;
+        });
+        if (first == glyph.columns.end())
+            return false;
+        glyph.columns.erase(glyph.columns.begin(), first);
+
+        glyphs.push_back(glyph);
+        auto &candidates = by_first_column[glyph.columns[0]];
+        candidates.push_back(glyphs.size() - 1);
+        std::stable_sort(candidates.begin(), candidates.end(), [this](size_t a, size_t b) {
+            return glyphs[a].columns.size() > glyphs[b].columns.size();
+        });
+        return true;
+    }
+
+    std::string GlyphMatcher::Decode(const uint8_t *dots, int width, int height, int top, int left, int right, char unknown) const {
+        std::string text;
+        left = std::max(left, 0);
+        right = std::min(right, width);
+        if (left >= right || !this->height)
+            return text;
+
+        // Transpose the line into column masks. Rows outside of the bitmap are blank.
+        int stride = width / 8;
+        std::vector<uint64_t> columns(right - left);
+        for (int iy = std::max(top, 0); iy < top + (int)this->height && iy < height; ++iy) {
+            const uint8_t *row = dots + iy * stride;
+            uint64_t bit = (uint64_t)1 << (iy - top);
+            for (int ix = left; ix != right; ++ix)
+                if (row[ix >> 3] & (0x80 >> (ix & 7)))
+                    columns[ix - left] |= bit;
+        }
+
+        size_t count = columns.size(), blank = 0;
+        for (size_t ix = 0; ix != count;) {
+            if (!columns[ix]) {
+                ++blank;
+                ++ix;
+                continue;
+            }
+            if (space_width && !text.empty() && blank >= space_width)
+                text += ' ';
+            blank = 0;
+
+            const Glyph *match = nullptr;
+            auto candidates = by_first_column.find(columns[ix]);
+            if (candidates != by_first_column.end())
+                for (size_t index : candidates->second) {
+                    const Glyph &glyph = glyphs[index];
+                    size_t glyph_width = glyph.columns.size();
+                    if (glyph_width <= count - ix && !std::memcmp(&columns[ix], glyph.columns.data(), glyph_width * sizeof(uint64_t))) {
+                        match = &glyph;
+                        break;
+                    }
+                }
+
+            if (match) {
+                text += match->text;
+                ix += match->columns.size();
+            } else {
+                text += unknown;
+                while (ix != count && columns[ix])
+                    ++ix;
+            }
+        }
+        return text;
+    }
+} // namespace casioemu
@@ -0,0 +1,59 @@
+#pragma once
+#include "../Config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace casioemu {
+    /**
+     * Turns a line of a 1bpp dot matrix back into text, given the bitmaps of
+     * the glyphs of a font.
+     *
+     * A line is transposed into one 64-bit mask per column, with bit (iy) set
+     * if the dot (iy) rows below the top of the line is set. A glyph is stored
+     * the same way, so comparing one column compares every row of it at once,
+     * and only glyphs whose first column matches are compared at all.
+     */
+    class GlyphMatcher {
+        struct Glyph {
+            std::string text;
+            std::vector<uint64_t> columns;
+        };
+        std::vector<Glyph> glyphs;
+        /**
+         * Indices into (glyphs) by the first column, widest glyph first.
+         */
+        std::unordered_map<uint64_t, std::vector<size_t>> by_first_column;
+        unsigned int height, space_width;
+
+    public:
+        static const unsigned int MAX_HEIGHT = 64;
+
+        /**
+         * A run of at least (space_width) blank columns between two glyphs is
+         * decoded as a space, unless (space_width) is zero.
+         */
+        GlyphMatcher(unsigned int height = 0, unsigned int space_width = 0);
+
+        unsigned int GetHeight() const;
+
+        /**
+         * Add a glyph decoded as (text). (rows) holds (height) strings of the
+         * same length, one character per dot, where ' ' and '.' are clear dots
+         * and anything else is a set dot. Blank columns on either side are
+         * ignored. Returns false if (rows) is malformed or blank.
+         */
+        bool AddGlyph(const std::string &text, const std::vector<std::string> &rows);
+
+        /**
+         * Decode the line whose top row is (top) in the bitmap (dots) of
+         * (width) by (height) dots, laid out as by ScreenBase::ReadDots, from
+         * column (left) up to (right). Dots that match no glyph are decoded as
+         * (unknown) up to the next blank column.
+         */
+        std::string Decode(const uint8_t *dots, int width, int height, int top, int left, int right, char unknown = '?') const;
+    };
+} // namespace casioemu
@@ -0,0 +1,101 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace casioemu {
+    MappedFile::MappedFile() : data(nullptr), size(0) {
+#ifdef _WIN32
+        mapping_handle = nullptr;
+#endif
+    }
+
+    MappedFile::~MappedFile() {
+        Close();
+    }
+
+#ifdef _WIN32
+    bool MappedFile::Open(const std::string &path, Mode mode) {
+        Close();
+
+        HANDLE file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size) || !file_size.QuadPart) {
+            CloseHandle(file_handle);
+            return false;
+        }
+
+        // The mapping object keeps the file open, so the file handle is not needed after this.
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, mode == MF_READ_ONLY ? PAGE_READONLY : PAGE_WRITECOPY, 0, 0, nullptr);
+        CloseHandle(file_handle);
+        if (!mapping_handle)
+            return false;
+
+        data = (uint8_t *)MapViewOfFile(mapping_handle, mode == MF_READ_ONLY ? FILE_MAP_READ : FILE_MAP_COPY, 0, 0, 0);
+        if (!data) {
+            CloseHandle(mapping_handle);
+            mapping_handle = nullptr;
+            return false;
+        }
+        size = file_size.QuadPart;
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping_handle)
+            CloseHandle(mapping_handle);
+        data = nullptr;
+        size = 0;
+        mapping_handle = nullptr;
+    }
+#else
+    bool MappedFile::Open(const std::string &path, Mode mode) {
+        Close();
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) || !file_stat.st_size) {
+            close(fd);
+            return false;
+        }
+
+        void *mapping = mmap(nullptr, file_stat.st_size, mode == MF_READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+
+        data = (uint8_t *)mapping;
+        size = file_stat.st_size;
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data)
+            munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+#endif
+
+    uint8_t *MappedFile::GetData() const {
+        return data;
+    }
+
+    size_t MappedFile::GetSize() const {
+        return size;
+    }
+} // namespace casioemu
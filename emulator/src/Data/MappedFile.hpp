@@ -0,0 +1,52 @@
+#pragma once
+#include "../Config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace casioemu {
+    /**
+     * A file mapped into memory. Mappings of the same file share physical
+     * pages, so opening a file that another emulator already has open costs
+     * neither a copy nor a read.
+     */
+    class MappedFile {
+    public:
+        enum Mode {
+            /**
+             * The mapping is read-only. Writing to it is undefined.
+             */
+            MF_READ_ONLY,
+            /**
+             * Writes are private to this mapping and never reach the file.
+             * Pages are copied on first write.
+             */
+            MF_COPY_ON_WRITE
+        };
+
+    private:
+        uint8_t *data;
+        size_t size;
+#ifdef _WIN32
+        void *mapping_handle;
+#endif
+
+    public:
+        MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile();
+
+        /**
+         * Maps the whole file at (path). Returns false and leaves errno or the
+         * Windows last error set if the file cannot be mapped. Empty files
+         * cannot be mapped.
+         */
+        bool Open(const std::string &path, Mode mode);
+        void Close();
+
+        uint8_t *GetData() const;
+        size_t GetSize() const;
+    };
+} // namespace casioemu
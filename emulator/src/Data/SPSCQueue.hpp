@@ -0,0 +1,52 @@
+#pragma once
+#include "../Config.hpp"
+
+#include <atomic>
+#include <cstddef>
+
+namespace casioemu {
+    /**
+     * A bounded single-producer single-consumer queue. The slots are allocated
+     * once and reused, so a producer that refills the containers in its slots
+     * stops allocating after the first (capacity) values. Neither side ever
+     * blocks: the producer gets nullptr when the queue is full, the consumer
+     * when it's empty.
+     */
+    template <typename value_type, size_t capacity>
+    class SPSCQueue {
+        value_type slots[capacity]{};
+        std::atomic<size_t> head, tail;
+
+    public:
+        SPSCQueue() : head(0), tail(0) {
+        }
+
+        /**
+         * Producer side. Fill the returned slot, then call `Push()`.
+         */
+        value_type *Back() {
+            size_t back = tail.load(std::memory_order_relaxed);
+            if (back - head.load(std::memory_order_acquire) == capacity)
+                return nullptr;
+            return &slots[back % capacity];
+        }
+
+        void Push() {
+            tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /**
+         * Consumer side. Read the returned slot, then call `Pop()`.
+         */
+        value_type *Front() {
+            size_t front = head.load(std::memory_order_relaxed);
+            if (front == tail.load(std::memory_order_acquire))
+                return nullptr;
+            return &slots[front % capacity];
+        }
+
+        void Pop() {
+            head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    };
+} // namespace casioemu
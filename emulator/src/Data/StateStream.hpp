@@ -0,0 +1,88 @@
+#pragma once
+#include "../Config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace casioemu {
+    /**
+     * Appends machine state to a flat byte buffer. Values are copied verbatim,
+     * so a state can only be loaded by the same build of the emulator.
+     */
+    class StateWriter {
+        std::vector<uint8_t> &buffer;
+
+    public:
+        StateWriter(std::vector<uint8_t> &_buffer) : buffer(_buffer) {
+        }
+
+        void WriteBytes(const void *data, size_t size) {
+            buffer.insert(buffer.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+        }
+
+        template <typename value_type>
+        void Write(const value_type &value) {
+            static_assert(std::is_trivially_copyable<value_type>::value, "only trivially copyable values can be written");
+            WriteBytes(&value, sizeof(value));
+        }
+    };
+
+    /**
+     * Reads back what a StateWriter wrote, in the same order. Reading past
+     * the end of the buffer sets the failure flag and yields zeroes instead.
+     */
+    class StateReader {
+        const uint8_t *data;
+        size_t size, position;
+        bool failed;
+
+    public:
+        StateReader(const uint8_t *_data, size_t _size) : data(_data), size(_size), position(0), failed(false) {
+        }
+
+        void ReadBytes(void *out, size_t count) {
+            if (failed || count > size - position) {
+                failed = true;
+                std::memset(out, 0, count);
+                return;
+            }
+            std::memcpy(out, data + position, count);
+            position += count;
+        }
+
+        template <typename value_type>
+        void Read(value_type &value) {
+            static_assert(std::is_trivially_copyable<value_type>::value, "only trivially copyable values can be read");
+            ReadBytes(&value, sizeof(value));
+        }
+
+        /**
+         * Read an enumeration written with StateWriter::Write, failing instead of
+         * storing it if it is greater than (max).
+         */
+        template <typename enum_type>
+        void ReadEnum(enum_type &value, enum_type max) {
+            typedef typename std::make_unsigned<typename std::underlying_type<enum_type>::type>::type raw_type;
+            raw_type raw;
+            Read(raw);
+            if (raw > (raw_type)max)
+                failed = true;
+            if (!failed)
+                value = (enum_type)raw;
+        }
+
+        /**
+         * True if every read so far succeeded and the whole buffer was consumed.
+         */
+        bool Good() const {
+            return !failed && position == size;
+        }
+
+        bool Failed() const {
+            return failed;
+        }
+    };
+} // namespace casioemu
@@ -0,0 +1,52 @@
+#pragma once
+#include "../Config.hpp"
+
+#include <atomic>
+
+namespace casioemu {
+    /**
+     * A single-producer single-consumer triple buffer. The producer fills
+     * `Back()` and calls `Publish()`; the consumer calls `Fetch()` and then
+     * reads `Front()`. Neither side ever blocks or waits for the other, and the
+     * consumer always sees the most recently published complete value.
+     */
+    template <typename value_type>
+    class TripleBuffer {
+        static const unsigned FRESH = 4, INDEX_MASK = 3;
+
+        value_type buffers[3]{};
+        std::atomic<unsigned> shared;
+        unsigned back, front;
+
+    public:
+        TripleBuffer() : shared(1), back(0), front(2) {
+        }
+
+        /**
+         * Producer side. The returned object keeps whatever was written to it
+         * two publications ago, so it should be overwritten completely.
+         */
+        value_type &Back() {
+            return buffers[back];
+        }
+
+        void Publish() {
+            back = shared.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        /**
+         * Consumer side. Returns true if a value newer than the current `Front()`
+         * has been published since the last call.
+         */
+        bool Fetch() {
+            if (!(shared.load(std::memory_order_relaxed) & FRESH))
+                return false;
+            front = shared.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+            return true;
+        }
+
+        value_type &Front() {
+            return buffers[front];
+        }
+    };
+} // namespace casioemu
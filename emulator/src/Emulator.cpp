@@ -1,21 +1,42 @@
 #include "Emulator.hpp"
 
+#include "Chipset/CPU.hpp"
 #include "Chipset/Chipset.hpp"
+#include "Chipset/MMU.hpp"
+#include "Data/ArgvNumber.hpp"
 #include "Data/EventCode.hpp"
+#include "Data/StateStream.hpp"
+#include "GdbServer.hpp"
+#include "LCDCapture.hpp"
 #include "Logger.hpp"
+#include "Peripheral/BatteryBackedRAM.hpp"
+#include "Peripheral/Keyboard.hpp"
+#include "Peripheral/Screen.hpp"
+#include "PluginHost.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <sstream>
 #include <string>
+#include <type_traits>
 
 namespace casioemu {
-    Emulator::Emulator(std::map<std::string, std::string> &_argv_map, bool _paused) : paused(_paused), argv_map(_argv_map), chipset(*new Chipset(*this)) {
+    // Identifies a buffer written by SaveState. Bump this whenever the state layout changes.
+    static const uint32_t STATE_MAGIC = 0x31534543;
+
+    Emulator::Emulator(std::map<std::string, std::string> &_argv_map, bool _paused) : paused(_paused), debug_state_sequence(0), argv_map(_argv_map), chipset(*new Chipset(*this)), publish_debug_state(false), code_viewer(nullptr), cycle_count(0) {
         std::lock_guard<decltype(access_mx)> access_lock(access_mx);
 
         running = true;
+        headless = argv_map.find("headless") != argv_map.end();
         model_path = argv_map["model"];
 
         lua_state = luaL_newstate();
@@ -28,11 +49,64 @@ namespace casioemu {
         if (hardware_id != HW_ES_PLUS && hardware_id != HW_CLASSWIZ)
             PANIC("Unknown hardware id %d\n", hardware_id);
         this->hardware_id = (HardwareId)hardware_id;
+        LoadLCDFonts();
+        LoadCalcVariables();
 
         unsigned int cycles_per_second = hardware_id == HW_ES_PLUS ? 128 * 1024 : 1024 * 1024;
         timer_interval = 20;
-
-        cycles.Setup(cycles_per_second, timer_interval);
+        slice_us = timer_interval * 1000;
+        auto slice_iter = argv_map.find("slice");
+        if (slice_iter != argv_map.end())
+            slice_us = ParseArgvNumber("slice", slice_iter->second, 1, 1000000);
+        overload_policy = OP_DROP;
+        auto overload_iter = argv_map.find("overload");
+        if (overload_iter != argv_map.end()) {
+            auto name = std::find(std::begin(overload_policy_names), std::end(overload_policy_names), overload_iter->second);
+            if (name == std::end(overload_policy_names))
+                PANIC("overload must be one of drop, catch_up and skip_frames\n");
+            overload_policy = (OverloadPolicy)(name - std::begin(overload_policy_names));
+        }
+        max_lag_us = 200000;
+        auto max_lag_iter = argv_map.find("max_lag");
+        if (max_lag_iter != argv_map.end())
+            max_lag_us = ParseArgvNumber("max_lag", max_lag_iter->second, 0, 60000) * 1000;
+        behind_us = dropped_us = 0;
+        stats_window_start = std::chrono::steady_clock::now();
+        stats_window_cycles = stats_window_dropped = 0;
+        stats_window_skipped = 0;
+        speed_stats = {};
+
+        latency_input = 0;
+        latency_input_version = 0;
+        latency_published = 0;
+        latency_count = latency_total_us = latency_max_us = latency_last_us = 0;
+
+        // The model's setting is checked the same way as the key that overrides it.
+        std::string run_ahead = "0";
+        lua_geti(lua_state, LUA_REGISTRYINDEX, lua_model_ref);
+        if (lua_getfield(lua_state, -1, "run_ahead") != LUA_TNIL) {
+            const char *value = lua_tostring(lua_state, -1);
+            if (!value)
+                PANIC("key 'run_ahead' is not a number\n");
+            run_ahead = value;
+        }
+        lua_pop(lua_state, 2);
+        auto run_ahead_iter = argv_map.find("run_ahead");
+        if (run_ahead_iter != argv_map.end())
+            run_ahead = run_ahead_iter->second;
+        run_ahead_frames = ParseArgvNumber("run_ahead", run_ahead, 0, MAX_RUN_AHEAD_FRAMES);
+        run_ahead_next_cycle = 0;
+        speculating = false;
+
+        script_max_cycles = headless ? (Uint64)cycles_per_second * 600 : 0;
+        auto script_max_cycles_iter = argv_map.find("script_max_cycles");
+        if (script_max_cycles_iter != argv_map.end())
+            script_max_cycles = ParseArgvNumber("script_max_cycles", script_max_cycles_iter->second, 0, std::numeric_limits<Uint64>::max());
+
+        cycles.Setup(cycles_per_second);
+        frame_cycles = (Uint64)cycles_per_second * timer_interval / 1000;
+        next_frame_cycle = 0;
+        frame_screen_version = 0;
         chipset.Setup();
 
         interface_background = GetModelInfo("rsd_interface");
@@ -61,50 +135,112 @@ namespace casioemu {
             PANIC("out of range width/height parameter\n");
         }
 
-        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
-        window = SDL_CreateWindow(
-            std::string(GetModelInfo("model_name")).c_str(),
-            SDL_WINDOWPOS_UNDEFINED,
-            SDL_WINDOWPOS_UNDEFINED,
-            width, height,
-            SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-        if (!window)
-            PANIC("SDL_CreateWindow failed: %s\n", SDL_GetError());
-        renderer = SDL_CreateRenderer(window, -1, 0);
-        if (!renderer)
-            PANIC("SDL_CreateRenderer failed: %s\n", SDL_GetError());
-
-        SDL_Surface *loaded_surface = IMG_Load(GetModelFilePath(GetModelInfo("interface_image_path")).c_str());
-        if (!loaded_surface)
-            PANIC("IMG_Load failed: %s\n", IMG_GetError());
-        interface_texture = SDL_CreateTextureFromSurface(renderer, loaded_surface);
-        SDL_FreeSurface(loaded_surface);
+        frame_request_pending = false;
+        if (headless) {
+            window = nullptr;
+            renderer = nullptr;
+            interface_texture = nullptr;
+            frame_texture = nullptr;
+        } else {
+            SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
+            SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
+            window = SDL_CreateWindow(
+                std::string(GetModelInfo("model_name")).c_str(),
+                SDL_WINDOWPOS_UNDEFINED,
+                SDL_WINDOWPOS_UNDEFINED,
+                width, height,
+                SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+            if (!window)
+                PANIC("SDL_CreateWindow failed: %s\n", SDL_GetError());
+            renderer = SDL_CreateRenderer(window, -1, 0);
+            if (!renderer)
+                PANIC("SDL_CreateRenderer failed: %s\n", SDL_GetError());
+
+            SDL_Surface *loaded_surface = IMG_Load(GetModelFilePath(GetModelInfo("interface_image_path")).c_str());
+            if (!loaded_surface)
+                PANIC("IMG_Load failed: %s\n", IMG_GetError());
+            interface_texture = SDL_CreateTextureFromSurface(renderer, loaded_surface);
+            SDL_FreeSurface(loaded_surface);
+
+            frame_texture = nullptr;
+            CreateFrameTexture();
+        }
 
         SetupInternals();
+        plugin_host = new PluginHost(*this);
         cycles.Reset();
 
-        tick_thread = new std::thread([this] {
-            auto iteration_end = std::chrono::steady_clock::now();
-            while (1) {
-                std::lock_guard<decltype(access_mx)> access_lock(access_mx);
-                if (!Running())
-                    return;
-                TimerCallback();
+        gdb_server = nullptr;
+        auto gdb_iter = argv_map.find("gdb");
+        if (gdb_iter != argv_map.end())
+            gdb_server = new GdbServer(*this, ParseArgvNumber("gdb", gdb_iter->second, 1, 65535));
+
+        capture = nullptr;
+        auto capture_iter = argv_map.find("capture");
+        if (capture_iter != argv_map.end()) {
+            unsigned int every_frames = 1;
+            auto capture_every_iter = argv_map.find("capture_every");
+            if (capture_every_iter != argv_map.end())
+                every_frames = ParseArgvNumber("capture_every", capture_every_iter->second, 1, std::numeric_limits<unsigned int>::max());
+            std::string error;
+            if (!StartCapture(capture_iter->second, every_frames, error))
+                PANIC("%s\n", error.c_str());
+        }
 
-                iteration_end += std::chrono::milliseconds(timer_interval);
-                auto now = std::chrono::steady_clock::now();
-                if (iteration_end > now)
-                    std::this_thread::sleep_until(iteration_end);
-                else // in case the computer is not fast enough or paused
-                    iteration_end = now;
-            }
-        });
-        tick_thread->detach();
+        tick_thread = nullptr;
+        if (!headless) {
+            tick_thread = new std::thread([this] {
+                auto slice = std::chrono::microseconds(slice_us);
+                auto iteration_end = std::chrono::steady_clock::now();
+                Uint64 lag_us = 0, lost_us = 0;
+                while (1) {
+                    {
+                        std::lock_guard<decltype(access_mx)> access_lock(access_mx);
+                        if (!Running())
+                            return;
+                        behind_us = lag_us;
+                        dropped_us = lost_us;
+                        lost_us = 0;
+                        TimerCallback();
+                    }
+
+                    // (access_mx) is not held while waiting, so that input is handled right away.
+                    iteration_end += slice;
+                    auto now = std::chrono::steady_clock::now();
+                    lag_us = 0;
+                    if (iteration_end > now) {
+                        // Input starts the next slice early, unless the last slice already did.
+                        // That keeps emulation at most two slices ahead of real time.
+                        std::unique_lock<std::mutex> wake_lock(slice_wake_mx);
+                        slice_wake_cv.wait_until(wake_lock, iteration_end, [&] {
+                            return slice_woken && std::chrono::steady_clock::now() >= iteration_end - slice;
+                        });
+                        slice_woken = false;
+                    } else {
+                        // The computer is not fast enough, or something held (access_mx) for long.
+                        lag_us = std::chrono::duration_cast<std::chrono::microseconds>(now - iteration_end).count();
+                        Uint64 limit = overload_policy == OP_DROP ? 0 : max_lag_us;
+                        if (lag_us > limit) {
+                            lost_us += lag_us - limit;
+                            lag_us = limit;
+                            iteration_end = now - std::chrono::microseconds(limit);
+                        }
+                    }
+                }
+            });
+            tick_thread->detach();
 
-        RunStartupScript();
+            RunStartupScript();
+        }
 
         chipset.Reset();
 
+        // Nothing else drives a headless emulator, so its script starts from a reset chipset.
+        if (headless) {
+            RunStartupScript();
+            RunScriptTasks();
+        }
+
         if (argv_map.find("paused") != argv_map.end())
             SetPaused(true);
 
@@ -112,22 +248,38 @@ namespace casioemu {
     }
 
     Emulator::~Emulator() {
-        if (tick_thread->joinable())
-            tick_thread->join();
-        delete tick_thread;
+        if (tick_thread) {
+            if (tick_thread->joinable())
+                tick_thread->join();
+            delete tick_thread;
+        }
+
+        // Its thread locks (access_mx), so it has to be stopped first.
+        delete gdb_server;
 
         std::lock_guard<decltype(access_mx)> access_lock(access_mx);
 
-        SDL_DestroyTexture(interface_texture);
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
+        StopCapture();
+
+        // Plugins may own memory regions, which have to go before the chipset does.
+        delete plugin_host;
+
+        if (!headless) {
+            SDL_DestroyTexture(frame_texture);
+            SDL_DestroyTexture(interface_texture);
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+        }
 
         luaL_unref(lua_state, LUA_REGISTRYINDEX, lua_model_ref);
         lua_close(lua_state);
         delete &chipset;
     }
 
-    void Emulator::HandleMemoryError() {
+    void Emulator::HandleMemoryError(size_t offset, bool write) {
+        if (speculating)
+            return;
+        events.Emit(EV_MEM_ERROR, offset, write);
         if (pause_on_mem_error) {
             logger::Info("execution paused due to memory error\n");
             SetPaused(true);
@@ -155,6 +307,25 @@ namespace casioemu {
             event.wheel.y *= (float)interface_background.dest.h / height;
             break;
         }
+
+        bool key_event = event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_MOUSEBUTTONUP ||
+                         ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat);
+        if (key_event) {
+            if (!latency_input && (event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_KEYDOWN)) {
+                latency_input = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+                latency_input_version = chipset.screen->GetVersion();
+            }
+            if (run_ahead_frames) {
+                run_ahead_until = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+                run_ahead_next_cycle = cycle_count;
+            }
+            {
+                std::lock_guard<std::mutex> wake_lock(slice_wake_mx);
+                slice_woken = true;
+            }
+            slice_wake_cv.notify_one();
+        }
+
         chipset.UIEvent(event);
     }
 
@@ -168,13 +339,104 @@ namespace casioemu {
             return;
         }
 
-        if (lua_pcall(lua_state, 0, 1, 0) != LUA_OK) {
-            logger::Info("%s\n", lua_tostring(lua_state, -1));
-            lua_pop(lua_state, 1);
-            return;
+        StartScriptTask(lua_state, 0);
+    }
+
+    void Emulator::StartScriptTask(lua_State *from, int nargs) {
+        lua_State *thread = lua_newthread(from);
+        int thread_ref = luaL_ref(from, LUA_REGISTRYINDEX);
+        lua_xmove(from, thread, nargs + 1);
+
+        ScriptTask task;
+        task.thread = thread;
+        task.thread_ref = thread_ref;
+        task.waiting = false;
+        script_tasks.push_back(task);
+        ResumeScriptTask(std::prev(script_tasks.end()), nargs);
+    }
+
+    std::list<Emulator::ScriptTask>::iterator Emulator::ResumeScriptTask(std::list<ScriptTask>::iterator task, int nargs) {
+        task->waiting = false;
+        int nresults;
+        int status = lua_resume(task->thread, nullptr, nargs, &nresults);
+        if (status == LUA_YIELD && task->waiting) {
+            lua_pop(task->thread, nresults);
+            return std::next(task);
+        }
+
+        if (status == LUA_YIELD)
+            logger::Info("script yielded outside of emu:wait_*, stopping it\n");
+        else if (status != LUA_OK)
+            logger::Info("%s\n", lua_tostring(task->thread, -1));
+        luaL_unref(lua_state, LUA_REGISTRYINDEX, task->thread_ref);
+        return script_tasks.erase(task);
+    }
+
+    void Emulator::CheckScriptTasks() {
+        // A resumed script may run the emulator itself, which gets here again for
+        // the other tasks. The task being resumed is not waiting, so it's skipped.
+        for (auto task = script_tasks.begin(); task != script_tasks.end();) {
+            RunStopReason reason;
+            Uint64 cycles_waited = cycle_count - task->start_cycle;
+            if (!task->waiting) {
+                ++task;
+                continue;
+            }
+            if (!CheckRunCondition(task->condition, cycles_waited, task->lcd_version, reason)) {
+                if (!script_max_cycles || cycles_waited < script_max_cycles) {
+                    ++task;
+                    continue;
+                }
+                logger::Info("script waited %llu cycles without its condition holding, resuming it with \"timeout\"\n",
+                             (unsigned long long)cycles_waited);
+                reason = RS_TIMEOUT;
+            }
+            PushRunResult(task->thread, reason, cycles_waited);
+            task = ResumeScriptTask(task, 2);
         }
     }
 
+    void Emulator::RunScriptTasks() {
+        while (running && !paused && !script_tasks.empty())
+            Tick();
+    }
+
+    int Emulator::PushRunResult(lua_State *lua_state, RunStopReason reason, Uint64 cycles_run) {
+        lua_pushstring(lua_state, run_stop_reason_names[reason]);
+        lua_pushinteger(lua_state, cycles_run);
+        return 2;
+    }
+
+    Uint64 Emulator::CheckMaxCycles(lua_State *lua_state, int index, bool wait) {
+        Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+        if (lua_isnoneornil(lua_state, index))
+            return wait ? 0 : (Uint64)emu->cycles.cycles_per_second * DEFAULT_RUN_SECONDS;
+        lua_Integer max_cycles = luaL_checkinteger(lua_state, index);
+        luaL_argcheck(lua_state, max_cycles >= 0, index, "cycle count must not be negative");
+        return max_cycles;
+    }
+
+    int Emulator::RunUntilFromLua(lua_State *lua_state, const RunCondition &condition) {
+        Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+        Uint64 cycles_run;
+        RunStopReason reason = emu->RunUntil(condition, cycles_run);
+        return PushRunResult(lua_state, reason, cycles_run);
+    }
+
+    int Emulator::WaitFromLua(lua_State *lua_state, const RunCondition &condition) {
+        Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+        if (lua_isyieldable(lua_state))
+            for (auto &task : emu->script_tasks)
+                if (task.thread == lua_state) {
+                    task.waiting = true;
+                    task.condition = condition;
+                    task.start_cycle = emu->cycle_count;
+                    task.lcd_version = emu->chipset.screen->GetVersion();
+                    return lua_yield(lua_state, 0);
+                }
+        return luaL_error(lua_state, "emu:wait_* can only be called directly from a script, not from a hook or coroutine");
+    }
+
     void Emulator::SetupLuaAPI() {
         *(Emulator **)lua_newuserdata(lua_state, sizeof(Emulator *)) = this;
         lua_newtable(lua_state);
@@ -193,6 +455,357 @@ namespace casioemu {
         });
         lua_setfield(lua_state, -2, "shutdown");
 
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:run(cycles)
+            RunCondition condition;
+            lua_Integer cycles = luaL_checkinteger(lua_state, 2);
+            luaL_argcheck(lua_state, cycles >= 0, 2, "cycle count must not be negative");
+            condition.max_cycles = cycles;
+            if (!condition.max_cycles)
+                return PushRunResult(lua_state, RS_CYCLES, 0);
+            return RunUntilFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "run");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:run_until_pc(addr[, min_sp[, max_cycles]])
+            RunCondition condition;
+            condition.stop_on_pc = true;
+            condition.pc = luaL_checkinteger(lua_state, 2) & ~1;
+            if (!lua_isnoneornil(lua_state, 3)) {
+                condition.check_sp = true;
+                condition.min_sp = luaL_checkinteger(lua_state, 3);
+            }
+            condition.max_cycles = CheckMaxCycles(lua_state, 4, false);
+            return RunUntilFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "run_until_pc");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:run_until_halt([max_cycles])
+            RunCondition condition;
+            condition.stop_on_halt = true;
+            condition.max_cycles = CheckMaxCycles(lua_state, 2, false);
+            return RunUntilFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "run_until_halt");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:run_until_lcd_change([max_cycles])
+            RunCondition condition;
+            condition.stop_on_lcd_change = true;
+            condition.max_cycles = CheckMaxCycles(lua_state, 2, false);
+            return RunUntilFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "run_until_lcd_change");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:run_until_mem(addr, value[, mask[, max_cycles]])
+            RunCondition condition;
+            condition.stop_on_mem = true;
+            condition.mem_offset = luaL_checkinteger(lua_state, 2);
+            if (condition.mem_offset >= (1 << 24))
+                return luaL_error(lua_state, "offset %zX doesn't fit 24 bits", condition.mem_offset);
+            condition.mem_mask = luaL_optinteger(lua_state, 4, 0xFF);
+            condition.mem_value = luaL_checkinteger(lua_state, 3) & condition.mem_mask;
+            condition.max_cycles = CheckMaxCycles(lua_state, 5, false);
+            return RunUntilFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "run_until_mem");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:run_until_settled([frames[, max_cycles]])
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            lua_Integer frames = luaL_optinteger(lua_state, 2, KeyTiming().settle_frames);
+            luaL_argcheck(lua_state, frames >= 0, 2, "frame count must not be negative");
+            Uint64 max_cycles = CheckMaxCycles(lua_state, 3, false);
+            Uint64 cycles_run;
+            RunStopReason reason = emu->RunUntilSettled(frames, max_cycles, cycles_run);
+            return PushRunResult(lua_state, reason, cycles_run);
+        });
+        lua_setfield(lua_state, -2, "run_until_settled");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:keys(sequence[, options])
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            size_t size;
+            const char *sequence = luaL_checklstring(lua_state, 2, &size);
+
+            KeyTiming timing;
+            if (!lua_isnoneornil(lua_state, 3)) {
+                luaL_checktype(lua_state, 3, LUA_TTABLE);
+                lua_getfield(lua_state, 3, "press");
+                timing.press_cycles = luaL_optinteger(lua_state, -1, timing.press_cycles);
+                lua_getfield(lua_state, 3, "release");
+                timing.release_cycles = luaL_optinteger(lua_state, -1, timing.release_cycles);
+                lua_getfield(lua_state, 3, "settle_frames");
+                timing.settle_frames = luaL_optinteger(lua_state, -1, timing.settle_frames);
+                lua_getfield(lua_state, 3, "max_cycles");
+                timing.settle_max_cycles = luaL_optinteger(lua_state, -1, timing.settle_max_cycles);
+                lua_pop(lua_state, 4);
+            }
+
+            // luaL_error doesn't unwind the C++ stack, so it's only raised once (codes) is gone.
+            char error[80] = "";
+            Uint64 cycles_run = 0;
+            RunStopReason reason = RS_CYCLES;
+            {
+                std::vector<uint8_t> codes;
+                std::string lookup_error;
+                if (emu->chipset.keyboard->LookupKeys(std::string(sequence, size), codes, lookup_error))
+                    reason = emu->TypeKeys(codes, timing, cycles_run);
+                else
+                    std::snprintf(error, sizeof(error), "%s", lookup_error.c_str());
+            }
+            if (*error)
+                return luaL_error(lua_state, "%s", error);
+            return PushRunResult(lua_state, reason, cycles_run);
+        });
+        lua_setfield(lua_state, -2, "keys");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:lcd() -> dots, width, height, icons
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            ScreenBase &screen = *emu->chipset.screen;
+            std::vector<uint8_t> dots;
+            screen.ReadDots(dots);
+            lua_pushlstring(lua_state, (const char *)dots.data(), dots.size());
+            lua_pushinteger(lua_state, screen.GetWidth());
+            lua_pushinteger(lua_state, screen.GetHeight());
+
+            std::vector<const char *> icons;
+            screen.ReadStatus(icons);
+            lua_createtable(lua_state, 0, icons.size());
+            for (const char *icon : icons) {
+                lua_pushboolean(lua_state, 1);
+                lua_setfield(lua_state, -2, icon);
+            }
+            return 4;
+        });
+        lua_setfield(lua_state, -2, "lcd");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:lcd_font(name, font)
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            const char *name = luaL_checkstring(lua_state, 2);
+            const char *error;
+            {
+                GlyphMatcher font;
+                error = ReadLCDFont(lua_state, 3, font);
+                if (!error)
+                    emu->lcd_fonts[name] = font;
+            }
+            if (error)
+                return luaL_error(lua_state, "%s", error);
+            return 0;
+        });
+        lua_setfield(lua_state, -2, "lcd_font");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:lcd_text(font, top[, left[, right]])
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            const char *name = luaL_checkstring(lua_state, 2);
+            int top = luaL_checkinteger(lua_state, 3);
+            int left = luaL_optinteger(lua_state, 4, 0);
+            ScreenBase &screen = *emu->chipset.screen;
+            int right = luaL_optinteger(lua_state, 5, screen.GetWidth());
+
+            auto font = emu->lcd_fonts.find(name);
+            if (font == emu->lcd_fonts.end())
+                return luaL_error(lua_state, "unknown font '%s'", name);
+            std::vector<uint8_t> dots;
+            screen.ReadDots(dots);
+            std::string text = font->second.Decode(dots.data(), screen.GetWidth(), screen.GetHeight(), top, left, right);
+            lua_pushlstring(lua_state, text.data(), text.size());
+            return 1;
+        });
+        lua_setfield(lua_state, -2, "lcd_text");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:capture_start(path[, every_n_frames])
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            const char *path = luaL_checkstring(lua_state, 2);
+            lua_Integer every_frames = luaL_optinteger(lua_state, 3, 1);
+            if (every_frames < 1)
+                return luaL_error(lua_state, "every_n_frames must be positive");
+            char message[256];
+            bool started;
+            {
+                std::string error;
+                started = emu->StartCapture(path, every_frames, error);
+                std::snprintf(message, sizeof(message), "%s", error.c_str());
+            }
+            if (!started)
+                return luaL_error(lua_state, "%s", message);
+            return 0;
+        });
+        lua_setfield(lua_state, -2, "capture_start");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            emu->StopCapture();
+            return 0;
+        });
+        lua_setfield(lua_state, -2, "capture_stop");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:number(addr) -> number, or nil if it's not a valid number
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            size_t offset = luaL_checkinteger(lua_state, 2);
+            if (offset > (1 << 24) - CALC_NUMBER_SIZE)
+                return luaL_error(lua_state, "offset %zX doesn't fit 24 bits", offset);
+            double value;
+            if (emu->ReadCalcNumber(offset, value))
+                lua_pushnumber(lua_state, value);
+            else
+                lua_pushnil(lua_state);
+            return 1;
+        });
+        lua_setfield(lua_state, -2, "number");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:set_number(addr, value) -> false if (value) is out of range
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            size_t offset = luaL_checkinteger(lua_state, 2);
+            double value = luaL_checknumber(lua_state, 3);
+            if (offset > (1 << 24) - CALC_NUMBER_SIZE)
+                return luaL_error(lua_state, "offset %zX doesn't fit 24 bits", offset);
+            lua_pushboolean(lua_state, emu->WriteCalcNumber(offset, value));
+            return 1;
+        });
+        lua_setfield(lua_state, -2, "set_number");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:variables() -> {name = number or array of numbers}, false for invalid numbers
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            std::vector<double> values;
+            emu->ReadCalcVariables(values);
+            lua_createtable(lua_state, 0, emu->calc_variables.size());
+            size_t index = 0;
+            for (auto &variable : emu->calc_variables) {
+                if (variable.count)
+                    lua_createtable(lua_state, variable.count, 0);
+                for (size_t ix = 0; ix != (variable.count ? variable.count : 1); ++ix, ++index) {
+                    if (std::isnan(values[index]))
+                        lua_pushboolean(lua_state, 0);
+                    else
+                        lua_pushnumber(lua_state, values[index]);
+                    if (variable.count)
+                        lua_rawseti(lua_state, -2, ix + 1);
+                }
+                lua_setfield(lua_state, -2, variable.name.c_str());
+            }
+            return 1;
+        });
+        lua_setfield(lua_state, -2, "variables");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:wait_cycles(cycles)
+            RunCondition condition;
+            lua_Integer cycles = luaL_checkinteger(lua_state, 2);
+            luaL_argcheck(lua_state, cycles >= 0, 2, "cycle count must not be negative");
+            condition.max_cycles = cycles;
+            if (!condition.max_cycles)
+                return PushRunResult(lua_state, RS_CYCLES, 0);
+            return WaitFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "wait_cycles");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:wait_pc(addr[, min_sp[, max_cycles]])
+            RunCondition condition;
+            condition.stop_on_pc = true;
+            condition.pc = luaL_checkinteger(lua_state, 2) & ~1;
+            if (!lua_isnoneornil(lua_state, 3)) {
+                condition.check_sp = true;
+                condition.min_sp = luaL_checkinteger(lua_state, 3);
+            }
+            condition.max_cycles = CheckMaxCycles(lua_state, 4, true);
+            return WaitFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "wait_pc");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:wait_halt([max_cycles])
+            RunCondition condition;
+            condition.stop_on_halt = true;
+            condition.max_cycles = CheckMaxCycles(lua_state, 2, true);
+            return WaitFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "wait_halt");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:wait_lcd_change([max_cycles])
+            RunCondition condition;
+            condition.stop_on_lcd_change = true;
+            condition.max_cycles = CheckMaxCycles(lua_state, 2, true);
+            return WaitFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "wait_lcd_change");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:wait_mem(addr, value[, mask[, max_cycles]])
+            RunCondition condition;
+            condition.stop_on_mem = true;
+            condition.mem_offset = luaL_checkinteger(lua_state, 2);
+            if (condition.mem_offset >= (1 << 24))
+                return luaL_error(lua_state, "offset %zX doesn't fit 24 bits", condition.mem_offset);
+            condition.mem_mask = luaL_optinteger(lua_state, 4, 0xFF);
+            condition.mem_value = luaL_checkinteger(lua_state, 3) & condition.mem_mask;
+            condition.max_cycles = CheckMaxCycles(lua_state, 5, true);
+            return WaitFromLua(lua_state, condition);
+        });
+        lua_setfield(lua_state, -2, "wait_mem");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:spawn(fn, ...)
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            luaL_checktype(lua_state, 2, LUA_TFUNCTION);
+            emu->StartScriptTask(lua_state, lua_gettop(lua_state) - 2);
+            return 0;
+        });
+        lua_setfield(lua_state, -2, "spawn");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            lua_pushinteger(lua_state, emu->cycle_count);
+            return 1;
+        });
+        lua_setfield(lua_state, -2, "cycles");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:latency() -> last, average, maximum input-to-photon latency in milliseconds, count
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            uint64_t count = emu->latency_count;
+            lua_pushnumber(lua_state, emu->latency_last_us / 1000.0);
+            lua_pushnumber(lua_state, count ? emu->latency_total_us / 1000.0 / count : 0.0);
+            lua_pushnumber(lua_state, emu->latency_max_us / 1000.0);
+            lua_pushinteger(lua_state, count);
+            return 4;
+        });
+        lua_setfield(lua_state, -2, "latency");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            // emu:stats() -> {speed = ..., dropped_cycles = ..., ...}
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            const SpeedStats &stats = emu->speed_stats;
+            lua_createtable(lua_state, 0, 6);
+            lua_pushnumber(lua_state, stats.speed);
+            lua_setfield(lua_state, -2, "speed");
+            lua_pushinteger(lua_state, stats.dropped_cycles);
+            lua_setfield(lua_state, -2, "dropped_cycles");
+            lua_pushinteger(lua_state, stats.skipped_frames);
+            lua_setfield(lua_state, -2, "skipped_frames");
+            lua_pushinteger(lua_state, stats.total_dropped_cycles);
+            lua_setfield(lua_state, -2, "total_dropped_cycles");
+            lua_pushinteger(lua_state, stats.total_skipped_frames);
+            lua_setfield(lua_state, -2, "total_skipped_frames");
+            lua_pushstring(lua_state, overload_policy_names[emu->overload_policy]);
+            lua_setfield(lua_state, -2, "overload");
+            return 1;
+        });
+        lua_setfield(lua_state, -2, "stats");
+
         lua_pushcfunction(lua_state, [](lua_State *lua_state) {
             Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
             emu->SetPaused(lua_toboolean(lua_state, 2));
@@ -222,6 +835,49 @@ namespace casioemu {
         });
         lua_setfield(lua_state, -2, "run_mode");
 
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            std::vector<uint8_t> state;
+            emu->SaveState(state);
+            lua_pushlstring(lua_state, (const char *)state.data(), state.size());
+            return 1;
+        });
+        lua_setfield(lua_state, -2, "save_state");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            size_t size;
+            const char *state = luaL_checklstring(lua_state, 2, &size);
+            std::string error;
+            if (emu->LoadState((const uint8_t *)state, size, error)) {
+                lua_pushboolean(lua_state, true);
+                return 1;
+            }
+            lua_pushboolean(lua_state, false);
+            lua_pushstring(lua_state, ("state " + error).c_str());
+            return 2;
+        });
+        lua_setfield(lua_state, -2, "load_state");
+
+        for (int type = 0; type != EV_COUNT; ++type) {
+            lua_event_refs[type] = LUA_REFNIL;
+            lua_pushinteger(lua_state, type);
+            lua_pushcclosure(lua_state, [](lua_State *lua_state) {
+                // emu:on_<event>(fn), fn = nil removes the handler
+                Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+                EventType type = (EventType)lua_tointeger(lua_state, lua_upvalueindex(1));
+                lua_settop(lua_state, 2);
+                if (emu->lua_event_refs[type] != LUA_REFNIL)
+                    emu->events.Unsubscribe(type, LuaEventHandler, emu);
+                luaL_unref(lua_state, LUA_REGISTRYINDEX, emu->lua_event_refs[type]);
+                emu->lua_event_refs[type] = luaL_ref(lua_state, LUA_REGISTRYINDEX);
+                if (emu->lua_event_refs[type] != LUA_REFNIL)
+                    emu->events.Subscribe(type, LuaEventHandler, emu);
+                return 0;
+            }, 1);
+            lua_setfield(lua_state, -2, (std::string("on_") + EventBus::names[type]).c_str());
+        }
+
         lua_model_ref = LUA_REFNIL;
         lua_pushcfunction(lua_state, [](lua_State *lua_state) {
             Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
@@ -261,6 +917,32 @@ namespace casioemu {
         });
         lua_setfield(lua_state, -2, "post_tick");
 
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            size_t real_pc = luaL_checkinteger(lua_state, 2);
+            lua_settop(lua_state, 3);
+            emu->chipset.cpu.SetPCHook(real_pc, luaL_ref(lua_state, LUA_REGISTRYINDEX));
+            return 0;
+        });
+        lua_setfield(lua_state, -2, "on_pc");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            size_t real_pc = luaL_checkinteger(lua_state, 2);
+            lua_settop(lua_state, 3);
+            emu->chipset.cpu.SetCallHook(real_pc, luaL_ref(lua_state, LUA_REGISTRYINDEX));
+            return 0;
+        });
+        lua_setfield(lua_state, -2, "on_call");
+
+        lua_pushcfunction(lua_state, [](lua_State *lua_state) {
+            Emulator *emu = *(Emulator **)lua_topointer(lua_state, 1);
+            lua_settop(lua_state, 2);
+            emu->chipset.cpu.SetReturnHook(luaL_ref(lua_state, LUA_REGISTRYINDEX));
+            return 0;
+        });
+        lua_setfield(lua_state, -2, "on_return");
+
         lua_setfield(lua_state, -2, "__index");
         lua_pushcfunction(lua_state, [](lua_State *) {
             return 0;
@@ -270,6 +952,22 @@ namespace casioemu {
         lua_setglobal(lua_state, "emu");
     }
 
+    void Emulator::LuaEventHandler(void *userdata, EventType type, uint32_t arg0, uint32_t arg1) {
+        Emulator *emu = (Emulator *)userdata;
+        lua_State *lua_state = emu->lua_state;
+        lua_geti(lua_state, LUA_REGISTRYINDEX, emu->lua_event_refs[type]);
+        lua_pushinteger(lua_state, arg0);
+        lua_pushinteger(lua_state, arg1);
+        if (lua_pcall(lua_state, 2, 0, 0) != LUA_OK) {
+            logger::Info("%s event handler failed: %s\n", EventBus::names[type], lua_tostring(lua_state, -1));
+            lua_pop(lua_state, 1);
+            emu->events.Unsubscribe(type, LuaEventHandler, emu);
+            luaL_unref(lua_state, LUA_REGISTRYINDEX, emu->lua_event_refs[type]);
+            emu->lua_event_refs[type] = LUA_REFNIL;
+            logger::Info("  %s event handler unregistered\n", EventBus::names[type]);
+        }
+    }
+
     void Emulator::SetupInternals() {
         chipset.SetupInternals();
     }
@@ -285,6 +983,147 @@ namespace casioemu {
             PANIC("LoadModelDefition failed: model failed to call emu.model\n");
     }
 
+    const char *Emulator::ReadLCDFont(lua_State *lua_state, int index, GlyphMatcher &font) {
+        index = lua_absindex(lua_state, index);
+        if (!lua_istable(lua_state, index))
+            return "font must be a table";
+
+        lua_getfield(lua_state, index, "height");
+        lua_getfield(lua_state, index, "space");
+        bool valid = lua_isinteger(lua_state, -2) && (lua_isnil(lua_state, -1) || lua_isinteger(lua_state, -1));
+        lua_Integer height = lua_tointeger(lua_state, -2);
+        lua_Integer space = lua_tointeger(lua_state, -1);
+        lua_pop(lua_state, 2);
+        if (!valid || height < 1 || height > GlyphMatcher::MAX_HEIGHT || space < 0)
+            return "font height must be between 1 and 64, and space must be a non-negative integer";
+        font = GlyphMatcher(height, space);
+
+        if (lua_getfield(lua_state, index, "glyphs") != LUA_TTABLE) {
+            lua_pop(lua_state, 1);
+            return "font glyphs must be a table";
+        }
+        const char *error = nullptr;
+        std::vector<std::string> rows;
+        lua_pushnil(lua_state);
+        while (!error && lua_next(lua_state, -2)) {
+            // Glyphs map text to a table of (height) strings, e.g. ["1"] = {"..#..", ".##..", ...}.
+            if (lua_type(lua_state, -2) != LUA_TSTRING || !lua_istable(lua_state, -1)) {
+                error = "font glyphs must map strings to tables of rows";
+                lua_pop(lua_state, 2);
+                break;
+            }
+            rows.clear();
+            lua_Integer count = luaL_len(lua_state, -1);
+            for (lua_Integer iy = 1; iy <= count; ++iy) {
+                if (lua_geti(lua_state, -1, iy) == LUA_TSTRING)
+                    rows.push_back(lua_tostring(lua_state, -1));
+                lua_pop(lua_state, 1);
+            }
+            if (rows.size() != (size_t)count || !font.AddGlyph(lua_tostring(lua_state, -2), rows)) {
+                error = "font glyphs must have (height) non-blank rows of the same length";
+                lua_pop(lua_state, 1);
+            }
+            lua_pop(lua_state, 1);
+        }
+        lua_pop(lua_state, 1);
+        return error;
+    }
+
+    void Emulator::LoadLCDFonts() {
+        // lcd_fonts is optional and maps font names to font tables, see emu:lcd_font().
+        const char *key = "lcd_fonts";
+        lua_geti(lua_state, LUA_REGISTRYINDEX, lua_model_ref);
+        int type = lua_getfield(lua_state, -1, key);
+        if (type != LUA_TNIL && type != LUA_TTABLE)
+            PANIC("key '%s' is not a table\n", key);
+        if (type == LUA_TTABLE) {
+            lua_pushnil(lua_state);
+            while (lua_next(lua_state, -2)) {
+                if (lua_type(lua_state, -2) != LUA_TSTRING)
+                    PANIC("key '%s' must map strings to fonts\n", key);
+                std::string name = lua_tostring(lua_state, -2);
+                if (const char *error = ReadLCDFont(lua_state, -1, lcd_fonts[name]))
+                    PANIC("key '%s'['%s']: %s\n", key, name.c_str(), error);
+                lua_pop(lua_state, 1);
+            }
+        }
+        lua_pop(lua_state, 2);
+    }
+
+    void Emulator::LoadCalcVariables() {
+        const char *key = "variables";
+        lua_geti(lua_state, LUA_REGISTRYINDEX, lua_model_ref);
+        int type = lua_getfield(lua_state, -1, key);
+        if (type != LUA_TNIL && type != LUA_TTABLE)
+            PANIC("key '%s' is not a table\n", key);
+        if (type == LUA_TTABLE) {
+            lua_pushnil(lua_state);
+            while (lua_next(lua_state, -2)) {
+                if (lua_type(lua_state, -2) != LUA_TSTRING)
+                    PANIC("key '%s' must map strings to addresses\n", key);
+                CalcVariable variable;
+                variable.name = lua_tostring(lua_state, -2);
+                variable.count = 0;
+                variable.stride = CALC_NUMBER_SIZE;
+                if (lua_istable(lua_state, -1)) {
+                    for (int ix = 1; ix != 4; ++ix)
+                        lua_geti(lua_state, -ix, ix);
+                    if (!lua_isinteger(lua_state, -3) || !lua_isinteger(lua_state, -2) || (!lua_isnil(lua_state, -1) && !lua_isinteger(lua_state, -1)))
+                        PANIC("key '%s'['%s'] must be {address, count[, stride]}\n", key, variable.name.c_str());
+                    variable.offset = lua_tointeger(lua_state, -3);
+                    variable.count = lua_tointeger(lua_state, -2);
+                    if (!lua_isnil(lua_state, -1))
+                        variable.stride = lua_tointeger(lua_state, -1);
+                    lua_pop(lua_state, 3);
+                    if (!variable.count || variable.stride < CALC_NUMBER_SIZE)
+                        PANIC("key '%s'['%s'] has an invalid count or stride\n", key, variable.name.c_str());
+                } else if (lua_isinteger(lua_state, -1))
+                    variable.offset = lua_tointeger(lua_state, -1);
+                else
+                    PANIC("key '%s'['%s'] is not an address\n", key, variable.name.c_str());
+
+                size_t size = variable.count ? (variable.count - 1) * variable.stride + CALC_NUMBER_SIZE : CALC_NUMBER_SIZE;
+                if (variable.offset >= (1 << 24) || size > (1 << 24) - variable.offset)
+                    PANIC("key '%s'['%s'] doesn't fit 24 bits\n", key, variable.name.c_str());
+                calc_variables.push_back(variable);
+                lua_pop(lua_state, 1);
+            }
+        }
+        lua_pop(lua_state, 2);
+
+        std::sort(calc_variables.begin(), calc_variables.end(), [](const CalcVariable &a, const CalcVariable &b) {
+            return a.offset < b.offset;
+        });
+    }
+
+    bool Emulator::ReadCalcNumber(size_t offset, double &value) {
+        uint8_t bytes[CALC_NUMBER_SIZE];
+        chipset.mmu.ReadBlock(offset, bytes, CALC_NUMBER_SIZE, true);
+        return DecodeCalcNumber(bytes, value);
+    }
+
+    bool Emulator::WriteCalcNumber(size_t offset, double value) {
+        uint8_t bytes[CALC_NUMBER_SIZE];
+        if (!EncodeCalcNumber(value, bytes))
+            return false;
+        chipset.mmu.WriteBlock(offset, bytes, CALC_NUMBER_SIZE, true);
+        return true;
+    }
+
+    void Emulator::ReadCalcVariables(std::vector<double> &values) {
+        values.clear();
+        std::vector<uint8_t> bytes;
+        for (auto &variable : calc_variables) {
+            size_t count = variable.count ? variable.count : 1;
+            bytes.resize((count - 1) * variable.stride + CALC_NUMBER_SIZE);
+            chipset.mmu.ReadBlock(variable.offset, bytes.data(), bytes.size(), true);
+            for (size_t ix = 0; ix != count; ++ix) {
+                double value;
+                values.push_back(DecodeCalcNumber(&bytes[ix * variable.stride], value) ? value : NAN);
+            }
+        }
+    }
+
     std::string Emulator::GetModelFilePath(std::string relative_path) {
         return model_path + "/" + relative_path;
     }
@@ -292,57 +1131,268 @@ namespace casioemu {
     void Emulator::TimerCallback() {
         std::lock_guard<decltype(access_mx)> access_lock(access_mx);
 
-        Uint64 cycles_to_emulate = cycles.GetDelta();
+        ApplyDebugEdits();
+
+        Uint64 cycles_before = cycle_count;
+        Uint64 cycles_to_emulate = cycles.GetDelta(slice_us);
         for (Uint64 ix = 0; ix != cycles_to_emulate; ++ix)
             if (!paused)
                 Tick();
 
-        if (chipset.GetRequireFrame()) {
-            SDL_Event event;
-            SDL_zero(event);
-            event.type = SDL_USEREVENT;
-            event.user.code = CE_FRAME_REQUEST;
-            SDL_PushEvent(&event);
+        // While catching up, the frame is left for a slice that runs on time.
+        bool skip_frame = overload_policy == OP_SKIP_FRAMES && behind_us >= slice_us;
+        // While run-ahead is on, frames from the future replace the current ones. Once per
+        // emulated frame is enough, and the present is only published when it looks the same.
+        bool run_ahead_on = run_ahead_frames && !paused && !skip_frame && std::chrono::steady_clock::now() < run_ahead_until;
+        bool run_ahead_due = run_ahead_on && cycle_count >= run_ahead_next_cycle;
+        bool ran_ahead = false;
+        if (run_ahead_due) {
+            run_ahead_next_cycle = cycle_count + frame_cycles;
+            ran_ahead = RunAhead();
+        }
+        if (chipset.GetRequireFrame() && skip_frame)
+            ++stats_window_skipped;
+        else if (ran_ahead || (chipset.GetRequireFrame() && (!run_ahead_on || run_ahead_due))) {
+            if (!ran_ahead)
+                chipset.PublishFrame();
+            if (!frame_request_pending.exchange(true)) {
+                SDL_Event event;
+                SDL_zero(event);
+                event.type = SDL_USEREVENT;
+                event.user.code = CE_FRAME_REQUEST;
+                SDL_PushEvent(&event);
+            }
+        }
+
+        if (latency_input) {
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            // The frame published above shows the response; a press without one is forgotten after a second.
+            if (ran_ahead || chipset.screen->GetVersion() != latency_input_version) {
+                latency_published = latency_input;
+                latency_input = 0;
+            } else if (now - latency_input > 1000000000)
+                latency_input = 0;
+        }
+
+        UpdateSpeedStats(cycle_count - cycles_before);
+
+        if (publish_debug_state)
+            PublishDebugState();
+    }
+
+    bool Emulator::RunAhead() {
+        SaveState(run_ahead_state);
+        uint64_t version = chipset.screen->GetVersion();
+
+        // Only the chipset is ticked, so that Lua hooks, script tasks and the frame clock don't see this either.
+        speculating = true;
+        events.SetMuted(true);
+        for (Uint64 ix = 0; ix != run_ahead_frames * frame_cycles; ++ix)
+            chipset.Tick();
+        events.SetMuted(false);
+        speculating = false;
+
+        bool changed = chipset.screen->GetVersion() != version;
+        if (changed)
+            chipset.PublishFrame();
+
+        if (!LoadState(run_ahead_state.data(), run_ahead_state.size()))
+            PANIC("run-ahead failed to restore the machine state\n");
+        chipset.screen->SetVersion(version);
+        return changed;
+    }
+
+    void Emulator::UpdateSpeedStats(Uint64 cycles_run) {
+        stats_window_cycles += cycles_run;
+        stats_window_dropped += dropped_us * cycles.cycles_per_second / 1000000;
+
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - stats_window_start).count();
+        if (seconds < 1)
+            return;
+
+        speed_stats.speed = stats_window_cycles / (seconds * cycles.cycles_per_second);
+        speed_stats.dropped_cycles = stats_window_dropped;
+        speed_stats.skipped_frames = stats_window_skipped;
+        speed_stats.total_dropped_cycles += stats_window_dropped;
+        speed_stats.total_skipped_frames += stats_window_skipped;
+        if (stats_window_dropped || stats_window_skipped)
+            logger::Info("behind real time: %.0f%% speed, %llu cycles dropped and %u frames skipped in the last second\n",
+                         speed_stats.speed * 100, (unsigned long long)stats_window_dropped, stats_window_skipped);
+
+        stats_window_start = now;
+        stats_window_cycles = stats_window_dropped = 0;
+        stats_window_skipped = 0;
+    }
+
+    bool Emulator::StartCapture(const std::string &path, unsigned int every_frames, std::string &error) {
+        StopCapture();
+        capture = new LCDCapture(*this, path, every_frames);
+        if (capture->Start(error))
+            return true;
+        StopCapture();
+        return false;
+    }
+
+    void Emulator::StopCapture() {
+        delete capture;
+        capture = nullptr;
+    }
+
+    void Emulator::QueueDebugEdit(std::function<void()> edit) {
+        std::lock_guard<std::mutex> lock(debug_edit_mx);
+        debug_edits.push_back(std::move(edit));
+    }
+
+    void Emulator::ApplyDebugEdits() {
+        std::vector<std::function<void()>> edits;
+        {
+            std::lock_guard<std::mutex> lock(debug_edit_mx);
+            edits.swap(debug_edits);
         }
+        for (auto &edit : edits)
+            edit();
+    }
+
+    void Emulator::PublishDebugState() {
+        DebugState &state = debug_state.Back();
+        CPU &cpu = chipset.cpu;
+
+        state.sequence = ++debug_state_sequence;
+        state.paused = paused;
+        state.run_mode = chipset.run_mode;
+
+        for (size_t ix = 0; ix != 16; ++ix)
+            state.reg_r[ix] = cpu.reg_r[ix];
+        for (size_t ix = 0; ix != 4; ++ix) {
+            state.reg_epsw[ix] = cpu.reg_epsw[ix];
+            state.reg_elr[ix] = cpu.reg_elr[ix];
+            state.reg_ecsr[ix] = cpu.reg_ecsr[ix];
+        }
+        state.reg_pc = cpu.reg_pc;
+        state.reg_csr = cpu.reg_csr;
+        state.reg_sp = cpu.reg_sp;
+        state.reg_ea = cpu.reg_ea;
+        state.backtrace = cpu.GetBacktrace();
+
+        BatteryBackedRAM &ram = *chipset.battery_backed_ram;
+        state.ram_base = ram.GetBase();
+        state.ram.assign(ram.ram_buffer, ram.ram_buffer + ram.GetSize());
+
+        const uint8_t *lcd = chipset.screen->GetBuffer();
+        state.lcd.assign(lcd, lcd + chipset.screen->GetBufferSize());
+
+        state.speed = speed_stats.speed;
+        state.dropped_cycles = speed_stats.dropped_cycles;
+        state.skipped_frames = speed_stats.skipped_frames;
+
+        // A paused emulator would publish the same state every slice, and the debugger would repaint for nothing.
+        if (last_debug_state.SameMachineState(state)) {
+            --debug_state_sequence;
+            return;
+        }
+        last_debug_state = state;
+        debug_state.Publish();
+        WakeDebugger();
+    }
+
+    void Emulator::WakeDebugger() {
+        {
+            std::lock_guard<std::mutex> lock(debugger_wake_mx);
+            debugger_woken = true;
+        }
+        debugger_wake_cv.notify_one();
+    }
+
+    bool Emulator::WaitDebugger(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(debugger_wake_mx);
+        bool woken = debugger_wake_cv.wait_for(lock, timeout, [this] {
+            return debugger_woken;
+        });
+        debugger_woken = false;
+        return woken;
     }
 
     void Emulator::Repaint() {
         SDL_RenderPresent(renderer);
     }
 
-    void Emulator::Frame() {
-        std::lock_guard<decltype(access_mx)> access_lock(access_mx);
+    void Emulator::CreateFrameTexture() {
+        if (frame_texture)
+            SDL_DestroyTexture(frame_texture);
 
-        // create texture `tx` with the same format as `interface_texture`
+        // Same format as `interface_texture`.
         Uint32 format;
         SDL_QueryTexture(interface_texture, &format, nullptr, nullptr, nullptr);
-        SDL_Texture *tx = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_TARGET, interface_background.dest.w, interface_background.dest.h);
+        frame_texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_TARGET, interface_background.dest.w, interface_background.dest.h);
+        if (!frame_texture)
+            PANIC("SDL_CreateTexture failed: %s\n", SDL_GetError());
+        frame_redraw_all = true;
+    }
 
-        // render on `tx`
-        SDL_SetRenderTarget(renderer, tx);
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_RenderClear(renderer);
-        SDL_SetTextureColorMod(interface_texture, 255, 255, 255);
-        SDL_SetTextureAlphaMod(interface_texture, 255);
-        SDL_RenderCopy(renderer, interface_texture, &interface_background.src, nullptr);
-        chipset.Frame();
+    void Emulator::Frame() {
+        // Whatever is published from here on needs another request.
+        frame_request_pending = false;
+        int64_t latency_input_time = latency_published.exchange(0);
+
+        // Only the peripherals that changed draw on `frame_texture`, unless it has to be drawn from scratch.
+        SDL_SetRenderTarget(renderer, frame_texture);
+        bool redraw_all = frame_redraw_all;
+        frame_redraw_all = false;
+        if (redraw_all) {
+            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+            SDL_RenderClear(renderer);
+            SDL_SetTextureColorMod(interface_texture, 255, 255, 255);
+            SDL_SetTextureAlphaMod(interface_texture, 255);
+            SDL_RenderCopy(renderer, interface_texture, &interface_background.src, nullptr);
+        }
+        chipset.Frame(redraw_all);
 
-        // resize and copy `tx` to screen
+        // resize and copy `frame_texture` to screen
         SDL_SetRenderTarget(renderer, nullptr);
         SDL_Rect dest{0, 0, width, height};
-        SDL_RenderCopy(renderer, tx, nullptr, &dest);
-        SDL_DestroyTexture(tx);
+        SDL_RenderCopy(renderer, frame_texture, nullptr, &dest);
         Repaint();
+
+        if (latency_input_time) {
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            uint64_t latency = (now - latency_input_time) / 1000;
+            latency_last_us = latency;
+            latency_total_us += latency;
+            ++latency_count;
+            if (latency > latency_max_us)
+                latency_max_us = latency;
+        }
+    }
+
+    void Emulator::RestoreBackground(const SDL_Rect &rect) {
+        // `interface_background.src` is stretched over the whole frame texture.
+        const SDL_Rect &src = interface_background.src, &dest = interface_background.dest;
+        SDL_Rect from{
+            src.x + rect.x * src.w / dest.w,
+            src.y + rect.y * src.h / dest.h,
+            rect.w * src.w / dest.w,
+            rect.h * src.h / dest.h};
+
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderFillRect(renderer, &rect);
+        SDL_SetTextureColorMod(interface_texture, 255, 255, 255);
+        SDL_SetTextureAlphaMod(interface_texture, 255);
+        SDL_RenderCopy(renderer, interface_texture, &from, &rect);
     }
 
     void Emulator::WindowResize(int _width, int _height) {
-        std::lock_guard<decltype(access_mx)> access_lock(access_mx);
         width = _width;
         height = _height;
+        // Some renderers lose the content of render targets along with the window size.
+        CreateFrameTexture();
         Frame();
     }
 
     void Emulator::Tick() {
+        ++cycle_count;
+
         if (lua_pre_tick_ref != LUA_REFNIL) {
             lua_geti(lua_state, LUA_REGISTRYINDEX, lua_pre_tick_ref);
             if (lua_pcall(lua_state, 0, 0, 0) != LUA_OK) {
@@ -356,6 +1406,12 @@ namespace casioemu {
 
         chipset.Tick();
 
+        if ((events.Subscribed(EV_FRAME) || capture) && cycle_count >= next_frame_cycle)
+            EmulatedFrame();
+
+        if (!script_tasks.empty())
+            CheckScriptTasks();
+
         if (lua_post_tick_ref != LUA_REFNIL) {
             lua_geti(lua_state, LUA_REGISTRYINDEX, lua_post_tick_ref);
             if (lua_pcall(lua_state, 0, 0, 0) != LUA_OK) {
@@ -368,37 +1424,225 @@ namespace casioemu {
         }
     }
 
+    void Emulator::EmulatedFrame() {
+        next_frame_cycle = cycle_count + frame_cycles;
+        if (capture)
+            capture->Frame();
+        uint64_t version = chipset.screen->GetVersion();
+        if (version == frame_screen_version)
+            return;
+        frame_screen_version = version;
+        events.Emit(EV_FRAME);
+    }
+
     bool Emulator::Running() {
         return running;
     }
 
+    bool Emulator::Headless() {
+        return headless;
+    }
+
+    const char *const Emulator::run_stop_reason_names[RS_COUNT] = {
+        "cycles", "pc", "halt", "lcd", "mem", "settled", "paused", "shutdown", "timeout"};
+
+    const char *const Emulator::overload_policy_names[3] = {"drop", "catch_up", "skip_frames"};
+
+    Emulator::RunStopReason Emulator::RunUntil(const RunCondition &condition, Uint64 &cycles_run) {
+        bool was_paused = paused;
+        paused = false;
+
+        uint64_t lcd_version = chipset.screen->GetVersion();
+        RunStopReason reason;
+        cycles_run = 0;
+        while (1) {
+            Tick();
+            ++cycles_run;
+
+            if (!running) {
+                reason = RS_SHUTDOWN;
+                break;
+            }
+            if (paused) {
+                reason = RS_PAUSED;
+                break;
+            }
+            if (CheckRunCondition(condition, cycles_run, lcd_version, reason))
+                break;
+        }
+
+        paused = paused || was_paused;
+        return reason;
+    }
+
+    Emulator::RunStopReason Emulator::RunUntilSettled(unsigned int frames, Uint64 max_cycles, Uint64 &cycles_run) {
+        cycles_run = 0;
+        unsigned int stable_frames = 0;
+        uint64_t lcd_version = chipset.screen->GetVersion();
+        while (1) {
+            RunCondition condition;
+            condition.max_cycles = frame_cycles;
+            if (max_cycles && max_cycles - cycles_run < frame_cycles)
+                condition.max_cycles = max_cycles - cycles_run;
+            Uint64 frame_cycles_run;
+            RunStopReason reason = RunUntil(condition, frame_cycles_run);
+            cycles_run += frame_cycles_run;
+            if (reason != RS_CYCLES)
+                return reason;
+
+            bool settled = chipset.run_mode != Chipset::RM_RUN && !chipset.keyboard->InputPending() &&
+                           chipset.screen->GetVersion() == lcd_version;
+            stable_frames = settled ? stable_frames + 1 : 0;
+            lcd_version = chipset.screen->GetVersion();
+            if (stable_frames >= frames)
+                return RS_SETTLED;
+            if (max_cycles && cycles_run >= max_cycles)
+                return RS_CYCLES;
+        }
+    }
+
+    Emulator::RunStopReason Emulator::TypeKeys(const std::vector<uint8_t> &codes, const KeyTiming &timing, Uint64 &cycles_run) {
+        cycles_run = 0;
+        RunCondition press, release;
+        press.max_cycles = timing.press_cycles ? timing.press_cycles : frame_cycles;
+        release.max_cycles = timing.release_cycles ? timing.release_cycles : frame_cycles;
+
+        for (uint8_t code : codes) {
+            if (!chipset.keyboard->PressCode(code))
+                logger::Info("TypeKeys: the model has no key %02X\n", code);
+            Uint64 step_cycles;
+            RunStopReason reason = RunUntil(press, step_cycles);
+            cycles_run += step_cycles;
+            chipset.keyboard->ReleaseAll();
+            if (reason != RS_CYCLES)
+                return reason;
+
+            reason = RunUntil(release, step_cycles);
+            cycles_run += step_cycles;
+            if (reason != RS_CYCLES)
+                return reason;
+        }
+
+        Uint64 settle_cycles;
+        RunStopReason reason = RunUntilSettled(timing.settle_frames, timing.settle_max_cycles, settle_cycles);
+        cycles_run += settle_cycles;
+        return reason;
+    }
+
+    bool Emulator::CheckRunCondition(const RunCondition &condition, Uint64 cycles_run, uint64_t lcd_version, RunStopReason &reason) {
+        if (condition.stop_on_pc && chipset.cpu.GetCurrentRealPC() == condition.pc &&
+            (!condition.check_sp || chipset.cpu.reg_sp.raw >= condition.min_sp)) {
+            reason = RS_PC;
+            return true;
+        }
+        if (condition.stop_on_halt && chipset.run_mode != Chipset::RM_RUN) {
+            reason = RS_HALT;
+            return true;
+        }
+        if (condition.stop_on_lcd_change && chipset.screen->GetVersion() != lcd_version) {
+            reason = RS_LCD;
+            return true;
+        }
+        if (condition.stop_on_mem) {
+            uint8_t value;
+            chipset.mmu.ReadBlock(condition.mem_offset, &value, 1, true);
+            if ((value & condition.mem_mask) == condition.mem_value) {
+                reason = RS_MEM;
+                return true;
+            }
+        }
+        if (condition.max_cycles && cycles_run >= condition.max_cycles) {
+            reason = RS_CYCLES;
+            return true;
+        }
+        return false;
+    }
+
+    Uint64 Emulator::RunCycles(Uint64 cycles_to_emulate) {
+        Uint64 ix = 0;
+        for (; ix != cycles_to_emulate && !paused && running; ++ix)
+            Tick();
+        return ix;
+    }
+
+    void Emulator::SaveState(std::vector<uint8_t> &state) {
+        state.clear();
+        StateWriter writer(state);
+        writer.Write(STATE_MAGIC);
+        writer.Write(hardware_id);
+        writer.Write(chipset.rom_size);
+        chipset.SaveState(writer);
+    }
+
+    bool Emulator::LoadState(const uint8_t *state, size_t size, std::string &error) {
+        StateReader reader(state, size);
+        uint32_t magic;
+        std::underlying_type<HardwareId>::type state_hardware_id;
+        size_t state_rom_size;
+        reader.Read(magic);
+        reader.Read(state_hardware_id);
+        reader.Read(state_rom_size);
+        if (reader.Failed()) {
+            error = "is truncated";
+            return false;
+        }
+        if (magic != STATE_MAGIC || state_hardware_id != hardware_id || state_rom_size != chipset.rom_size) {
+            error = "is from another model or emulator version";
+            return false;
+        }
+
+        // The chipset is changed as the state is read, so keep a copy to go back to.
+        SaveState(load_state_backup);
+        chipset.LoadState(reader);
+        if (reader.Good())
+            return true;
+
+        error = "is truncated or corrupt";
+        StateReader backup(load_state_backup.data(), load_state_backup.size());
+        backup.Read(magic);
+        backup.Read(state_hardware_id);
+        backup.Read(state_rom_size);
+        chipset.LoadState(backup);
+        if (!backup.Good())
+            PANIC("failed to restore the machine after a bad state\n");
+        return false;
+    }
+
+    bool Emulator::LoadState(const uint8_t *state, size_t size) {
+        std::string error;
+        return LoadState(state, size, error);
+    }
+
     bool Emulator::GetPaused() {
         return paused;
     }
 
     void Emulator::Shutdown() {
-        std::lock_guard<decltype(access_mx)> access_lock(access_mx);
         running = false;
     }
 
     void Emulator::ExecuteCommand(std::string command) {
         std::lock_guard<decltype(access_mx)> access_lock(access_mx);
-        lua_State *thread = lua_newthread(lua_state);
-        if (luaL_dostring(thread, command.c_str())) {
-            logger::Info("%s\n", lua_tostring(thread, -1));
+        if (luaL_loadstring(lua_state, command.c_str()) != LUA_OK) {
+            logger::Info("%s\n", lua_tostring(lua_state, -1));
+            lua_pop(lua_state, 1);
+        } else {
+            StartScriptTask(lua_state, 0);
         }
-        lua_pop(lua_state, 1); // pop thread
+
+        // The command may have changed anything, don't make the debugger wait for the next slice.
+        if (publish_debug_state)
+            PublishDebugState();
     }
 
     void Emulator::SetPaused(bool _paused) {
         paused = _paused;
     }
 
-    void Emulator::Cycles::Setup(Uint64 _cycles_per_second, unsigned int _timer_interval) {
+    void Emulator::Cycles::Setup(Uint64 _cycles_per_second) {
         ticks_now = 0;
         cycles_emulated = 0;
         cycles_per_second = _cycles_per_second;
-        timer_interval = _timer_interval;
     }
 
     void Emulator::Cycles::Reset() {
@@ -406,9 +1650,9 @@ namespace casioemu {
         cycles_emulated = 0;
     }
 
-    Uint64 Emulator::Cycles::GetDelta() {
-        ticks_now += timer_interval;
-        Uint64 cycles_to_have_been_emulated_by_now = ticks_now * cycles_per_second / 1000;
+    Uint64 Emulator::Cycles::GetDelta(Uint64 slice_us) {
+        ticks_now += slice_us;
+        Uint64 cycles_to_have_been_emulated_by_now = ticks_now * cycles_per_second / 1000000;
         Uint64 diff = cycles_to_have_been_emulated_by_now - cycles_emulated;
         cycles_emulated = cycles_to_have_been_emulated_by_now;
         return diff;
@@ -3,22 +3,37 @@
 
 #include <SDL.h>
 #include <SDL_image.h>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <list>
 #include <lua.hpp>
 #include <map>
 #include <mutex>
 #include <queue>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include "Data/CalcNumber.hpp"
+#include "Data/DebugState.hpp"
+#include "Data/GlyphMatcher.hpp"
 #include "Data/HardwareId.hpp"
 #include "Data/ModelInfo.hpp"
 #include "Data/SpriteInfo.hpp"
+#include "Data/TripleBuffer.hpp"
+#include "EventBus.hpp"
+
+class CodeViewer;
 
 namespace casioemu {
     class Chipset;
     class CPU;
     class MMU;
+    class GdbServer;
+    class LCDCapture;
+    class PluginHost;
 
     /**
      * A mutex that ensures that a thread cannot get the mutex right after it's released if there are another waiting thread.
@@ -40,13 +55,114 @@ namespace casioemu {
 
         SDL_Renderer *renderer;
         SDL_Texture *interface_texture;
+        /**
+         * The calculator as last drawn by Frame(), at the size of the interface
+         * background. It lives as long as the window does and is only created
+         * again by WindowResize(). (frame_redraw_all) is set when its content is
+         * gone, so that the next Frame() draws everything again.
+         */
+        SDL_Texture *frame_texture;
+        bool frame_redraw_all;
+        void CreateFrameTexture();
+        /**
+         * Set while a CE_FRAME_REQUEST event is queued, so that a GUI thread
+         * that falls behind gets one request rather than a backlog of them.
+         */
+        std::atomic<bool> frame_request_pending;
         unsigned int timer_interval;
-        bool running, paused;
+        /**
+         * Length of a slice of the tick thread in microseconds, set by the
+         * `slice` key and (timer_interval) by default. Shorter slices let the
+         * emulated program see input and the screen show its response sooner,
+         * at the cost of more wakeups. Input handled by UIEvent() may also
+         * start the next slice early.
+         */
+        unsigned int slice_us;
+        std::mutex slice_wake_mx;
+        std::condition_variable slice_wake_cv;
+        bool slice_woken = false;
+
+        /**
+         * What the tick thread does when it falls behind real time, set by the
+         * `overload` key.
+         */
+        enum OverloadPolicy {
+            OP_DROP,       // give up on the lost time right away
+            OP_CATCH_UP,   // run slices back to back until caught up, dropping what's more than (max_lag_us) behind
+            OP_SKIP_FRAMES // as OP_CATCH_UP, and don't publish frames while behind
+        } overload_policy;
+        static const char *const overload_policy_names[3];
+        Uint64 max_lag_us;
+        /**
+         * Set by the tick thread before every TimerCallback(): how far behind
+         * real time the slice starts, and the time given up on since the last
+         * slice, both in microseconds.
+         */
+        Uint64 behind_us, dropped_us;
+        /**
+         * Counters for the second of real time that will go into (speed_stats).
+         */
+        std::chrono::steady_clock::time_point stats_window_start;
+        Uint64 stats_window_cycles, stats_window_dropped;
+        unsigned int stats_window_skipped;
+        void UpdateSpeedStats(Uint64 cycles_run);
+
+        /**
+         * Input-to-photon latency: the time from a key or mouse button press in
+         * UIEvent() until a frame that shows the screen's response to it is
+         * presented. (latency_input) is the pending press, and the screen
+         * version at that time, only accessed with (access_mx) held. Once the
+         * screen changes, TimerCallback() hands the press over to Frame() in
+         * (latency_published). Times are steady_clock nanoseconds, 0 for none.
+         */
+        int64_t latency_input;
+        uint64_t latency_input_version;
+        std::atomic<int64_t> latency_published;
+        std::atomic<uint64_t> latency_count, latency_total_us, latency_max_us, latency_last_us;
+
+        /**
+         * Run-ahead, set by the model's `run_ahead` key or the key of the same
+         * name: for a second after every input change, once per emulated frame
+         * (starting with the slice right after the input) the tick thread
+         * saves the machine, emulates (run_ahead_frames) frames further,
+         * publishes what the screen shows then and rolls back. The calculator's
+         * response thus shows up that many frames early. 0 disables it.
+         */
+        static const unsigned int MAX_RUN_AHEAD_FRAMES = 16;
+        unsigned int run_ahead_frames;
+        std::chrono::steady_clock::time_point run_ahead_until;
+        Uint64 run_ahead_next_cycle;
+        std::vector<uint8_t> run_ahead_state;
+        /**
+         * Set while emulating ahead. Hooks, watchpoints, breakpoints and memory
+         * errors are ignored and events are muted, since none of it happens.
+         */
+        bool speculating;
+        // The machine as it was before a LoadState() in progress, restored if the state turns out bad.
+        std::vector<uint8_t> load_state_backup;
+        /**
+         * Returns true if the screen published differs from the current one.
+         */
+        bool RunAhead();
+        /**
+         * (running) is atomic so that Shutdown() can stop a long emu:run* call
+         * from another thread without waiting for (access_mx).
+         */
+        std::atomic<bool> running;
+        bool paused;
+        /**
+         * A headless emulator has no window, renderer or tick thread. It only
+         * advances when its owner calls Tick() or RunCycles().
+         */
+        bool headless;
         unsigned int last_frame_tick_count;
         std::string model_path;
         bool pause_on_mem_error;
 
         std::thread *tick_thread;
+        PluginHost *plugin_host;
+        GdbServer *gdb_server;
+        LCDCapture *capture;
 
         SpriteInfo interface_background;
         int width, height;
@@ -60,6 +176,49 @@ namespace casioemu {
         void SetupInternals();
         void RunStartupScript();
 
+        std::mutex debug_edit_mx;
+        std::vector<std::function<void()>> debug_edits;
+        uint64_t debug_state_sequence;
+        // A copy of the last state published, so that unchanged states are not published again.
+        DebugState last_debug_state{};
+        void ApplyDebugEdits();
+        void PublishDebugState();
+
+        std::mutex debugger_wake_mx;
+        std::condition_variable debugger_wake_cv;
+        bool debugger_woken = false;
+
+        /**
+         * The emulated frame clock. While anyone is subscribed to EV_FRAME or a
+         * capture is running, the screen is checked for changes every
+         * (frame_cycles) cycles.
+         */
+        Uint64 frame_cycles, next_frame_cycle;
+        uint64_t frame_screen_version;
+        void EmulatedFrame();
+
+        /**
+         * Lua functions registered with emu:on_halt() and friends, indexed by
+         * EventType, or LUA_REFNIL.
+         */
+        int lua_event_refs[EV_COUNT];
+        static void LuaEventHandler(void *userdata, EventType type, uint32_t arg0, uint32_t arg1);
+
+        /**
+         * Fonts for emu:lcd_text(), by name. They come from the optional model
+         * table `lcd_fonts` and from emu:lcd_font().
+         */
+        std::map<std::string, GlyphMatcher> lcd_fonts;
+        void LoadLCDFonts();
+        /**
+         * Build (font) from the font table at (index). Returns an error message,
+         * or nullptr on success, instead of raising a Lua error, so that callers
+         * can destroy their C++ objects first.
+         */
+        static const char *ReadLCDFont(lua_State *lua_state, int index, GlyphMatcher &font);
+
+        void LoadCalcVariables();
+
     public:
         SDL_Window *window;
         Emulator(std::map<std::string, std::string> &argv_map, bool paused = false);
@@ -79,16 +238,16 @@ namespace casioemu {
          * callback. This ensures that only as many cycles are emulated in a period
          * of time as many would be in real life.
          *
-         * Note that it's assumed that the GetDelta function is called once every
-         * timer_interval milliseconds. It's up to the timer to make sure that
-         * there's no drift.
+         * Note that it's assumed that the GetDelta function is called once for
+         * every slice of (slice_us) microseconds. Fractions of a cycle carry over
+         * to the next slice, but it's up to the timer to make sure that the
+         * slices don't drift.
          */
         struct Cycles {
-            void Setup(Uint64 cycles_per_second, unsigned int timer_interval);
+            void Setup(Uint64 cycles_per_second);
             void Reset();
-            Uint64 GetDelta();
+            Uint64 GetDelta(Uint64 slice_us);
             Uint64 ticks_now, cycles_emulated, cycles_per_second;
-            unsigned int timer_interval;
         } cycles;
 
     public:
@@ -99,16 +258,251 @@ namespace casioemu {
          */
         Chipset &chipset;
 
+        /**
+         * Peripherals and the chipset emit events here as they happen. Handlers
+         * run on the emulation thread with (access_mx) held.
+         */
+        EventBus events;
+
+        /**
+         * State published for the debugger GUI at the end of every timer slice
+         * while (publish_debug_state) is set. Only the GUI thread may call Fetch()
+         * and Front() on this.
+         */
+        TripleBuffer<DebugState> debug_state;
+        std::atomic<bool> publish_debug_state;
+        /**
+         * The debugger GUI only repaints after WaitDebugger() returns true,
+         * which happens when (debug_state) was published with a changed state
+         * or when someone calls WakeDebugger(), e.g. for input to the debugger
+         * window. Returns false if (timeout) passed first.
+         */
+        void WakeDebugger();
+        bool WaitDebugger(std::chrono::milliseconds timeout);
+        /**
+         * The debugger window attached to this emulator, if any.
+         */
+        std::atomic<CodeViewer *> code_viewer;
+        /**
+         * Queue a change requested by the debugger GUI. (edit) is run on the
+         * emulation thread, with (access_mx) held, at the next slice boundary.
+         */
+        void QueueDebugEdit(std::function<void()> edit);
+
+        /**
+         * Capture the screen to (path) every (every_frames) emulated frames, see
+         * LCDCapture. A capture that is already running is stopped first.
+         * StopCapture() waits until every sample taken so far is written.
+         * (access_mx) should be held by the caller.
+         */
+        bool StartCapture(const std::string &path, unsigned int every_frames, std::string &error);
+        void StopCapture();
+
         bool Running();
-        void HandleMemoryError();
+        bool Headless();
+        void HandleMemoryError(size_t offset, bool write);
         void Shutdown();
         void Tick();
+        /**
+         * Emulate up to (cycles) cycles on the calling thread. Stops early if the
+         * emulator gets paused, e.g. by a break point. Returns the number of
+         * cycles emulated. (access_mx) should be held by the caller.
+         */
+        Uint64 RunCycles(Uint64 cycles);
+
+        /**
+         * Total number of cycles emulated since the emulator was constructed.
+         */
+        Uint64 cycle_count;
+
+        /**
+         * How well the tick thread keeps up with real time, updated once per
+         * second. Only accessed with (access_mx) held. All zero for headless
+         * emulators, which have no tick thread.
+         */
+        struct SpeedStats {
+            double speed;                // emulated time per real time in the last second, 1 at full speed and 0 while paused
+            Uint64 dropped_cycles;       // cycles given up on in the last second
+            unsigned int skipped_frames; // frames not published in the last second
+            Uint64 total_dropped_cycles;
+            Uint64 total_skipped_frames;
+        } speed_stats;
+
+        enum RunStopReason {
+            RS_CYCLES,   // (max_cycles) cycles were emulated
+            RS_PC,       // the CPU reached (pc)
+            RS_HALT,     // the chipset entered HALT or STOP mode
+            RS_LCD,      // the screen changed
+            RS_MEM,      // the byte at (mem_offset) matched
+            RS_SETTLED,  // the calculator is waiting for input, see RunUntilSettled
+            RS_PAUSED,   // something paused the emulator, e.g. a break point
+            RS_SHUTDOWN, // the emulator was shut down
+            RS_TIMEOUT,  // a headless script waited longer than (script_max_cycles)
+            RS_COUNT
+        };
+        static const char *const run_stop_reason_names[RS_COUNT];
+
+        /**
+         * Conditions for RunUntil. Each one is checked after every instruction.
+         */
+        struct RunCondition {
+            // Zero means no limit.
+            Uint64 max_cycles = 0;
+            bool stop_on_pc = false;
+            size_t pc = 0;
+            // With (stop_on_pc), only stop if SP >= (min_sp), i.e. the stack has
+            // unwound at least as far as (min_sp). Used to step over calls.
+            bool check_sp = false;
+            uint16_t min_sp = 0;
+            bool stop_on_halt = false;
+            bool stop_on_lcd_change = false;
+            bool stop_on_mem = false;
+            size_t mem_offset = 0;
+            uint8_t mem_value = 0, mem_mask = 0xFF;
+        };
+        /**
+         * Emulate on the calling thread until one of the conditions holds. This
+         * runs whether or not the emulator is paused, and leaves it paused if it
+         * was paused before. (cycles_run) receives the number of cycles emulated.
+         * (access_mx) should be held by the caller.
+         */
+        RunStopReason RunUntil(const RunCondition &condition, Uint64 &cycles_run);
+
+        /**
+         * Emulate until the calculator is settled: halted, with no key press
+         * pending and the screen unchanged for (frames) emulated frames in a row.
+         * Gives up with RS_CYCLES after (max_cycles) cycles unless that's zero.
+         */
+        RunStopReason RunUntilSettled(unsigned int frames, Uint64 max_cycles, Uint64 &cycles_run);
+
+        struct KeyTiming {
+            // Cycles each key is held down and then released before the next one.
+            // Zero means one emulated frame.
+            Uint64 press_cycles = 0, release_cycles = 0;
+            // See RunUntilSettled.
+            unsigned int settle_frames = 3;
+            Uint64 settle_max_cycles = 0;
+        };
+        /**
+         * Press the keys with button_map codes (codes) one after another, then
+         * run until settled. Returns RS_SETTLED unless something interrupted
+         * the sequence. (access_mx) should be held by the caller.
+         */
+        RunStopReason TypeKeys(const std::vector<uint8_t> &codes, const KeyTiming &timing, Uint64 &cycles_run);
+
+    private:
+        /**
+         * Checks every condition of (condition) except pausing and shutdown.
+         * (cycles_run) and (lcd_version) are counted from where the wait began.
+         */
+        bool CheckRunCondition(const RunCondition &condition, Uint64 cycles_run, uint64_t lcd_version, RunStopReason &reason);
+
+        /**
+         * Helpers for the emu:run* and emu:wait_* Lua functions. They push the
+         * reason name and the number of cycles emulated and return 2.
+         */
+        static int PushRunResult(lua_State *lua_state, RunStopReason reason, Uint64 cycles_run);
+        /**
+         * The optional cycle budget at (index): when omitted, (DEFAULT_RUN_SECONDS)
+         * of emulated time for emu:run* and no limit for emu:wait_*, which
+         * (script_max_cycles) bounds instead. No limit when 0. Negative budgets
+         * are an error.
+         */
+        static const unsigned int DEFAULT_RUN_SECONDS = 60;
+        static Uint64 CheckMaxCycles(lua_State *lua_state, int index, bool wait);
+        static int RunUntilFromLua(lua_State *lua_state, const RunCondition &condition);
+        static int WaitFromLua(lua_State *lua_state, const RunCondition &condition);
+
+        /**
+         * Scripts run as Lua coroutines. A script that calls one of the emu:wait_*
+         * functions yields, and Tick() resumes it right after the instruction that
+         * satisfies its condition. The conditions are checked natively, so nothing
+         * in Lua runs while all scripts are waiting.
+         */
+        struct ScriptTask {
+            lua_State *thread;
+            int thread_ref;
+            bool waiting;
+            RunCondition condition;
+            Uint64 start_cycle;
+            uint64_t lcd_version;
+        };
+        std::list<ScriptTask> script_tasks;
+        /**
+         * A script that waits longer than this is resumed with RS_TIMEOUT, so
+         * that a headless emulator can't spin forever on a condition that never
+         * holds. Set by the `script_max_cycles` key; by default 10 emulated
+         * minutes for headless emulators and no limit (0) otherwise.
+         */
+        Uint64 script_max_cycles;
+        /**
+         * Start a task running the function below the top (nargs) values of
+         * (from)'s stack, with those values as arguments. Pops all of them.
+         */
+        void StartScriptTask(lua_State *from, int nargs);
+        /**
+         * Resume (task) with the top (nargs) values of its stack. Returns the
+         * iterator following (task), which is removed if it finished.
+         */
+        std::list<ScriptTask>::iterator ResumeScriptTask(std::list<ScriptTask>::iterator task, int nargs);
+        void CheckScriptTasks();
+        /**
+         * Emulate until no script is waiting. Only used by headless emulators,
+         * which have no tick thread to do it for them.
+         */
+        void RunScriptTasks();
+
+    public:
+        /**
+         * Calculator variables, from the optional model table `variables`. It maps
+         * names to the address of a number, or to {address, count[, stride]} for
+         * arrays such as matrices and statistics data. Sorted by address.
+         */
+        struct CalcVariable {
+            std::string name;
+            size_t offset;
+            size_t count;  // 0 for a single number
+            size_t stride; // bytes between array elements
+        };
+        std::vector<CalcVariable> calc_variables;
+        /**
+         * Decode every number in (calc_variables), array elements in place, into
+         * (values). Invalid numbers become NaN. Watchpoints are not triggered.
+         */
+        void ReadCalcVariables(std::vector<double> &values);
+        /**
+         * Read or write the number at (offset), bypassing watchpoints. See
+         * DecodeCalcNumber and EncodeCalcNumber for when these return false.
+         */
+        bool ReadCalcNumber(size_t offset, double &value);
+        bool WriteCalcNumber(size_t offset, double value);
+
+        /**
+         * Serialise the machine state, i.e. everything but the Lua state and the
+         * GUI, into (state). LoadState() returns false, sets (error) and leaves
+         * the machine as it was if (state) was saved by a different model, is
+         * truncated or holds invalid values.
+         * (access_mx) should be held by the caller.
+         */
+        void SaveState(std::vector<uint8_t> &state);
+        bool LoadState(const uint8_t *state, size_t size, std::string &error);
+        bool LoadState(const uint8_t *state, size_t size);
         /**
          * Called when SDL_WINDOWEVENT_EXPOSED event is received. Does not re-frame.
          */
         void Repaint();
+        /**
+         * Draw what the peripherals last published and present it. Only called
+         * on the GUI thread, and does not take (access_mx), so emulation and
+         * drawing don't wait for each other. Presenting waits for vsync.
+         */
         void Frame();
         void WindowResize(int width, int height);
+        /**
+         * Draw the interface background over (rect) of the frame texture. Only
+         * to be called from Peripheral::Frame().
+         */
+        void RestoreBackground(const SDL_Rect &rect);
         void ExecuteCommand(std::string command);
         unsigned int GetCyclesPerSecond();
         bool GetPaused();
@@ -0,0 +1,111 @@
+#include "EmulatorPool.hpp"
+
+#include "Emulator.hpp"
+#include "Logger.hpp"
+
+#include <utility>
+
+namespace casioemu {
+    EmulatorPool::EmulatorPool(std::map<std::string, std::string> argv_map, size_t count) : next_worker(0), queued(0), busy(count), stopping(false) {
+        if (!count)
+            PANIC("an emulator pool needs at least one instance\n");
+        argv_map["headless"] = "";
+        for (size_t ix = 0; ix != count; ++ix)
+            workers.emplace_back(new Worker);
+        for (size_t ix = 0; ix != count; ++ix)
+            workers[ix]->thread = std::thread(&EmulatorPool::WorkerMain, this, argv_map, ix);
+    }
+
+    EmulatorPool::~EmulatorPool() {
+        {
+            std::lock_guard<std::mutex> state_lock(state_mx);
+            stopping = true;
+        }
+        work_cv.notify_all();
+        for (auto &worker : workers)
+            worker->thread.join();
+    }
+
+    size_t EmulatorPool::Size() {
+        return workers.size();
+    }
+
+    void EmulatorPool::Submit(Job job) {
+        Worker &worker = *workers[next_worker++ % workers.size()];
+        {
+            std::lock_guard<std::mutex> jobs_lock(worker.jobs_mx);
+            worker.jobs.push_back(std::move(job));
+        }
+        {
+            std::lock_guard<std::mutex> state_lock(state_mx);
+            ++queued;
+        }
+        work_cv.notify_one();
+    }
+
+    void EmulatorPool::Submit(Snapshot snapshot, Job job) {
+        Submit([snapshot, job](Emulator &emulator) {
+            std::string error;
+            if (!emulator.LoadState(snapshot->data(), snapshot->size(), error))
+                PANIC("snapshot %s\n", error.c_str());
+            job(emulator);
+        });
+    }
+
+    void EmulatorPool::Wait() {
+        std::unique_lock<std::mutex> state_lock(state_mx);
+        idle_cv.wait(state_lock, [this] {
+            return !busy && !queued;
+        });
+    }
+
+    EmulatorPool::Job EmulatorPool::TakeJob(size_t index) {
+        // The caller has claimed a job by decrementing (queued), so one is guaranteed to be
+        // in some queue. Another worker may take it first from under us, in which case the
+        // job that worker had claimed is still queued somewhere and the scan just goes on.
+        for (size_t offset = 0;; ++offset) {
+            Worker &worker = *workers[(index + offset) % workers.size()];
+            std::lock_guard<std::mutex> jobs_lock(worker.jobs_mx);
+            if (worker.jobs.empty())
+                continue;
+
+            Job job;
+            if (!(offset % workers.size())) {
+                job = std::move(worker.jobs.front());
+                worker.jobs.pop_front();
+            } else {
+                job = std::move(worker.jobs.back());
+                worker.jobs.pop_back();
+            }
+            return job;
+        }
+    }
+
+    void EmulatorPool::WorkerMain(std::map<std::string, std::string> argv_map, size_t index) {
+        logger::SetThreadPrefix("[" + std::to_string(index) + "] ");
+
+        // Note: argv_map must be destructed after emulator.
+        Emulator emulator(argv_map);
+
+        std::unique_lock<std::mutex> state_lock(state_mx);
+        while (1) {
+            if (!--busy && !queued)
+                idle_cv.notify_all();
+            work_cv.wait(state_lock, [this] {
+                return stopping || queued;
+            });
+            if (!queued)
+                return;
+
+            --queued;
+            ++busy;
+            state_lock.unlock();
+            Job job = TakeJob(index);
+            {
+                std::lock_guard<decltype(emulator.access_mx)> access_lock(emulator.access_mx);
+                job(emulator);
+            }
+            state_lock.lock();
+        }
+    }
+} // namespace casioemu
@@ -0,0 +1,77 @@
+#pragma once
+#include "Config.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace casioemu {
+    class Emulator;
+
+    /**
+     * Runs a number of headless emulators, each on its own thread. Every
+     * instance is constructed from a copy of the same argument map, so all of
+     * them run the same model and startup script. ROM images and the opcode
+     * dispatch table are shared; everything else is per instance.
+     *
+     * Jobs are spread over per-worker queues. A worker that runs out of jobs
+     * steals from the back of another worker's queue.
+     */
+    class EmulatorPool {
+    public:
+        typedef std::function<void(Emulator &)> Job;
+        typedef std::shared_ptr<const std::vector<uint8_t>> Snapshot;
+
+    private:
+        struct Worker {
+            std::thread thread;
+            std::mutex jobs_mx;
+            std::deque<Job> jobs;
+        };
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<size_t> next_worker;
+
+        std::mutex state_mx;
+        std::condition_variable work_cv, idle_cv;
+        // Number of jobs submitted but not yet claimed by a worker.
+        size_t queued;
+        // Number of workers that are still starting up or running a job.
+        size_t busy;
+        bool stopping;
+
+        void WorkerMain(std::map<std::string, std::string> argv_map, size_t index);
+        Job TakeJob(size_t index);
+
+    public:
+        EmulatorPool(std::map<std::string, std::string> argv_map, size_t count);
+        ~EmulatorPool();
+
+        size_t Size();
+        /**
+         * Queue (job) to be run on whichever instance gets to it first. The job
+         * is called with that instance's (access_mx) held.
+         */
+        void Submit(Job job);
+        /**
+         * Like Submit, but the instance is first restored to (snapshot), which
+         * should come from Emulator::SaveState. Restoring costs about a copy of
+         * the machine state, so this is the cheap way to explore many inputs
+         * from one booted calculator.
+         */
+        void Submit(Snapshot snapshot, Job job);
+        /**
+         * Block until every instance has started up and every submitted job
+         * has finished.
+         */
+        void Wait();
+    };
+} // namespace casioemu
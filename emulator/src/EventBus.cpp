@@ -0,0 +1,32 @@
+#include "EventBus.hpp"
+
+#include <algorithm>
+
+namespace casioemu {
+    const char *const EventBus::names[EV_COUNT] = {
+        "halt", "interrupt", "frame", "key", "mem_error"};
+
+    EventBus::EventBus() : subscribed_mask(0), muted(false) {
+    }
+
+    void EventBus::Subscribe(EventType type, Handler handler, void *userdata) {
+        subscribers[type].push_back({handler, userdata});
+        subscribed_mask |= 1 << type;
+    }
+
+    void EventBus::Unsubscribe(EventType type, Handler handler, void *userdata) {
+        auto &list = subscribers[type];
+        list.erase(std::remove_if(list.begin(), list.end(), [&](const Subscriber &subscriber) {
+            return subscriber.handler == handler && subscriber.userdata == userdata;
+        }), list.end());
+        if (list.empty())
+            subscribed_mask &= ~(1 << type);
+    }
+
+    void EventBus::Dispatch(EventType type, uint32_t arg0, uint32_t arg1) {
+        // Handlers may subscribe or unsubscribe, so iterate over a copy.
+        std::vector<Subscriber> list = subscribers[type];
+        for (auto &subscriber : list)
+            subscriber.handler(subscriber.userdata, type, arg0, arg1);
+    }
+} // namespace casioemu
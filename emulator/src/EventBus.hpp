@@ -0,0 +1,62 @@
+#pragma once
+#include "Config.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace casioemu {
+    /**
+     * Events emitted by the emulator. Keep in sync with CASIOEMU_EVENT_* in
+     * casioemu_plugin.h and with EventBus::names.
+     */
+    enum EventType {
+        EV_HALT,      // the chipset entered HALT or STOP mode; (arg0) is the new run mode
+        EV_INTERRUPT, // the CPU took an interrupt; (arg0) is its index
+        EV_FRAME,     // the screen changed during the last emulated frame
+        EV_KEY,       // a button was pressed or released; (arg0) is its code in the model's button_map, (arg1) is 1 if it's pressed
+        EV_MEM_ERROR, // unmapped memory or ROM was accessed; (arg0) is the offset, (arg1) is 1 for writes
+        EV_COUNT
+    };
+
+    /**
+     * Delivers events to native subscribers. Emitting an event nobody has
+     * subscribed to costs a single bit test.
+     */
+    class EventBus {
+    public:
+        typedef void (*Handler)(void *userdata, EventType type, uint32_t arg0, uint32_t arg1);
+        static const char *const names[EV_COUNT];
+
+    private:
+        struct Subscriber {
+            Handler handler;
+            void *userdata;
+        };
+        std::vector<Subscriber> subscribers[EV_COUNT];
+        uint32_t subscribed_mask;
+        bool muted;
+        void Dispatch(EventType type, uint32_t arg0, uint32_t arg1);
+
+    public:
+        EventBus();
+        void Subscribe(EventType type, Handler handler, void *userdata);
+        void Unsubscribe(EventType type, Handler handler, void *userdata);
+
+        bool Subscribed(EventType type) const {
+            return subscribed_mask & (1 << type);
+        }
+
+        void Emit(EventType type, uint32_t arg0 = 0, uint32_t arg1 = 0) {
+            if (subscribed_mask & (1 << type) && !muted)
+                Dispatch(type, arg0, arg1);
+        }
+
+        /**
+         * Drop every event emitted until unmuted, e.g. while emulating ahead
+         * for run-ahead, which is rolled back afterwards.
+         */
+        void SetMuted(bool _muted) {
+            muted = _muted;
+        }
+    };
+} // namespace casioemu
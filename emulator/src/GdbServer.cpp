@@ -0,0 +1,539 @@
+#include "GdbServer.hpp"
+
+#include "Chipset/CPU.hpp"
+#include "Chipset/Chipset.hpp"
+#include "Chipset/MMU.hpp"
+#include "Emulator.hpp"
+#include "Logger.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace casioemu {
+#ifdef _WIN32
+    typedef SOCKET Socket;
+    static void CloseSocket(Socket socket) {
+        closesocket(socket);
+    }
+#else
+    typedef int Socket;
+    static const Socket INVALID_SOCKET = -1;
+    static void CloseSocket(Socket socket) {
+        close(socket);
+    }
+#endif
+
+    // The first 16 registers are r0 to r15. pc and lr hold the code segment in bits 16 and up.
+    static const struct {
+        const char *name;
+        int size; // bytes
+    } registers[] = {
+        {"r0", 1}, {"r1", 1}, {"r2", 1}, {"r3", 1}, {"r4", 1}, {"r5", 1}, {"r6", 1}, {"r7", 1},
+        {"r8", 1}, {"r9", 1}, {"r10", 1}, {"r11", 1}, {"r12", 1}, {"r13", 1}, {"r14", 1}, {"r15", 1},
+        {"pc", 4}, {"sp", 2}, {"ea", 2}, {"psw", 1}, {"lr", 4}};
+    static const size_t REGISTER_COUNT = sizeof(registers) / sizeof(registers[0]);
+
+    // Code memory is presented to the client above the 24-bit data space.
+    static const size_t CODE_BASE = 0x1000000, CODE_SIZE = 0x100000;
+
+    static std::string TargetXML() {
+        std::string xml = "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+                          "<target version=\"1.0\"><feature name=\"org.casioemu.nxu8\">";
+        for (size_t ix = 0; ix != REGISTER_COUNT; ++ix) {
+            const char *type = ix == 16 || ix == 20 ? "code_ptr" : ix == 17 || ix == 18 ? "data_ptr" : "int";
+            xml += std::string("<reg name=\"") + registers[ix].name + "\" bitsize=\"" + std::to_string(registers[ix].size * 8) + "\" type=\"" + type + "\"/>";
+        }
+        return xml + "</feature></target>";
+    }
+
+    static std::string ToHex(uint32_t value, int size) {
+        // Little endian, as registers are sent.
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        for (int ix = 0; ix != size; ++ix, value >>= 8) {
+            hex += digits[(value >> 4) & 0xF];
+            hex += digits[value & 0xF];
+        }
+        return hex;
+    }
+
+    static int HexDigit(char digit) {
+        if (digit >= '0' && digit <= '9')
+            return digit - '0';
+        if (digit >= 'a' && digit <= 'f')
+            return digit - 'a' + 10;
+        if (digit >= 'A' && digit <= 'F')
+            return digit - 'A' + 10;
+        return -1;
+    }
+
+    static bool FromHex(const std::string &hex, size_t pos, int size, uint32_t &value) {
+        if (pos + size * 2 > hex.size())
+            return false;
+        value = 0;
+        for (int ix = size - 1; ix >= 0; --ix) {
+            int high = HexDigit(hex[pos + ix * 2]);
+            int low = HexDigit(hex[pos + ix * 2 + 1]);
+            if (high < 0 || low < 0)
+                return false;
+            value = value << 8 | high << 4 | low;
+        }
+        return true;
+    }
+
+    GdbServer::GdbServer(Emulator &_emulator, unsigned short _port) : emulator(_emulator), stopping(false), port(_port), watch_hit(false) {
+#ifdef _WIN32
+        WSADATA wsa_data;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa_data))
+            PANIC("WSAStartup failed\n");
+#endif
+        thread = std::thread(&GdbServer::ServerMain, this);
+    }
+
+    GdbServer::~GdbServer() {
+        stopping = true;
+        thread.join();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    void GdbServer::ServerMain() {
+        Socket listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener == INVALID_SOCKET) {
+            logger::Info("gdb: failed to create socket\n");
+            return;
+        }
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener, (sockaddr *)&address, sizeof(address)) || listen(listener, 1)) {
+            logger::Info("gdb: failed to listen on port %u\n", port);
+            CloseSocket(listener);
+            return;
+        }
+        logger::Info("gdb: listening on 127.0.0.1:%u\n", port);
+
+        while (!stopping && emulator.Running()) {
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(listener, &readable);
+            timeval timeout = {0, 100000};
+            if (select(listener + 1, &readable, nullptr, nullptr, &timeout) <= 0)
+                continue;
+            Socket client = accept(listener, nullptr, nullptr);
+            if (client == INVALID_SOCKET)
+                continue;
+            logger::Info("gdb: client connected\n");
+            Serve(client);
+            CloseSocket(client);
+            logger::Info("gdb: client disconnected\n");
+        }
+        CloseSocket(listener);
+    }
+
+    void GdbServer::Serve(std::intptr_t client_handle) {
+        Socket client = (Socket)client_handle;
+        auto send_all = [client](const std::string &data) {
+            for (size_t done = 0; done != data.size();) {
+                int sent = send(client, data.data() + done, data.size() - done, 0);
+                if (sent <= 0)
+                    return false;
+                done += sent;
+            }
+            return true;
+        };
+        auto send_packet = [&send_all](const std::string &payload) {
+            uint8_t checksum = 0;
+            for (char c : payload)
+                checksum += c;
+            char trailer[4];
+            std::snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+            return send_all("$" + payload + trailer);
+        };
+
+        // Attaching stops the target, as gdb expects.
+        {
+            std::lock_guard<decltype(emulator.access_mx)> access_lock(emulator.access_mx);
+            emulator.SetPaused(true);
+        }
+
+        std::string input;
+        bool running = false, detach = false;
+        while (!stopping && !detach) {
+            if (running) {
+                std::lock_guard<decltype(emulator.access_mx)> access_lock(emulator.access_mx);
+                if (!emulator.Running()) {
+                    send_packet("W00");
+                    break;
+                }
+                if (emulator.GetPaused()) {
+                    running = false;
+                    if (!send_packet(StopReply()))
+                        break;
+                }
+            }
+
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(client, &readable);
+            timeval timeout = {0, running ? 10000 : 100000};
+            int ready = select(client + 1, &readable, nullptr, nullptr, &timeout);
+            if (ready < 0)
+                break;
+            if (!ready) {
+                if (!emulator.Running())
+                    break;
+                continue;
+            }
+            char buffer[4096];
+            int received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+                break;
+            input.append(buffer, received);
+
+            while (!input.empty()) {
+                if (input[0] == '\x03') {
+                    // Interrupt from the client. The stop is reported by the poll above.
+                    input.erase(0, 1);
+                    std::lock_guard<decltype(emulator.access_mx)> access_lock(emulator.access_mx);
+                    emulator.SetPaused(true);
+                    continue;
+                }
+                if (input[0] != '$') {
+                    // Acknowledgements and stray bytes.
+                    input.erase(0, 1);
+                    continue;
+                }
+                size_t hash = input.find('#');
+                if (hash == std::string::npos || hash + 3 > input.size())
+                    break;
+                std::string packet = input.substr(1, hash - 1);
+                uint8_t checksum = 0;
+                for (char c : packet)
+                    checksum += c;
+                bool valid = HexDigit(input[hash + 1]) >= 0 && HexDigit(input[hash + 2]) >= 0 &&
+                             (HexDigit(input[hash + 1]) << 4 | HexDigit(input[hash + 2])) == checksum;
+                input.erase(0, hash + 3);
+                if (!send_all(valid ? "+" : "-")) {
+                    detach = true;
+                    break;
+                }
+                if (!valid)
+                    continue;
+
+                std::string reply;
+                {
+                    std::lock_guard<decltype(emulator.access_mx)> access_lock(emulator.access_mx);
+                    reply = HandlePacket(packet, running, detach);
+                }
+                // Continuing packets are answered once the target stops.
+                if (!running && !send_packet(reply)) {
+                    detach = true;
+                    break;
+                }
+            }
+        }
+
+        std::lock_guard<decltype(emulator.access_mx)> access_lock(emulator.access_mx);
+        ClearPoints();
+        emulator.SetPaused(false);
+    }
+
+    std::string GdbServer::HandlePacket(const std::string &packet, bool &running, bool &detach) {
+        char command = packet.empty() ? 0 : packet[0];
+        std::string args = packet.substr(packet.empty() ? 0 : 1);
+
+        switch (command) {
+        case '?':
+            return StopReply();
+
+        case 'g':
+            return ReadRegisters();
+
+        case 'G':
+            WriteRegisters(args);
+            return "OK";
+
+        case 'p': {
+            size_t index = std::strtoul(args.c_str(), nullptr, 16);
+            if (index >= REGISTER_COUNT)
+                return "E01";
+            std::string all = ReadRegisters();
+            size_t pos = 0;
+            for (size_t ix = 0; ix != index; ++ix)
+                pos += registers[ix].size * 2;
+            return all.substr(pos, registers[index].size * 2);
+        }
+
+        case 'P': {
+            size_t equals = args.find('=');
+            size_t index = std::strtoul(args.c_str(), nullptr, 16);
+            if (equals == std::string::npos || index >= REGISTER_COUNT)
+                return "E01";
+            std::string all = ReadRegisters();
+            size_t pos = 0;
+            for (size_t ix = 0; ix != index; ++ix)
+                pos += registers[ix].size * 2;
+            std::string value = args.substr(equals + 1);
+            if (value.size() != (size_t)registers[index].size * 2)
+                return "E01";
+            WriteRegisters(all.replace(pos, value.size(), value));
+            return "OK";
+        }
+
+        case 'm': {
+            char *end;
+            size_t offset = std::strtoul(args.c_str(), &end, 16);
+            size_t size = *end == ',' ? std::strtoul(end + 1, nullptr, 16) : 0;
+            return ReadMemory(offset, size);
+        }
+
+        case 'M': {
+            char *end;
+            size_t offset = std::strtoul(args.c_str(), &end, 16);
+            size_t colon = args.find(':');
+            if (*end != ',' || colon == std::string::npos)
+                return "E01";
+            std::string hex = args.substr(colon + 1);
+            if (hex.size() != std::strtoul(end + 1, nullptr, 16) * 2)
+                return "E01";
+            return WriteMemory(offset, hex) ? "OK" : "E01";
+        }
+
+        case 'c':
+            watch_hit = false;
+            emulator.SetPaused(false);
+            running = true;
+            return "";
+
+        case 's': {
+            watch_hit = false;
+            Emulator::RunCondition condition;
+            condition.max_cycles = 1;
+            Uint64 cycles_run;
+            emulator.RunUntil(condition, cycles_run);
+            emulator.SetPaused(true);
+            return StopReply();
+        }
+
+        case 'v':
+            if (packet == "vCont?")
+                return "vCont;c;C;s;S";
+            if (packet.compare(0, 6, "vCont;") == 0) {
+                // There's only one thread, so the first action is the one that applies.
+                char action = packet.size() > 6 ? packet[6] : 0;
+                if (action == 'c' || action == 'C')
+                    return HandlePacket("c", running, detach);
+                if (action == 's' || action == 'S')
+                    return HandlePacket("s", running, detach);
+                return "E01";
+            }
+            return "";
+
+        case 'Z':
+        case 'z': {
+            // Z<type>,<addr>,<kind>
+            char *end;
+            size_t offset = args.size() > 2 ? std::strtoul(args.c_str() + 2, &end, 16) : 0;
+            if (args.size() <= 2 || args[1] != ',' || *end != ',')
+                return "E01";
+            size_t size = std::strtoul(end + 1, nullptr, 16);
+            return SetPoint(args[0], offset, size, command == 'Z') ? "OK" : "";
+        }
+
+        case 'D':
+            detach = true;
+            return "OK";
+
+        case 'k':
+            detach = true;
+            return "";
+
+        case 'H':
+        case 'T':
+            return "OK";
+
+        case 'q':
+            if (packet.compare(0, 10, "qSupported") == 0)
+                return "PacketSize=4000;qXfer:features:read+;swbreak+;hwbreak+;vContSupported+";
+            if (packet == "qAttached")
+                return "1";
+            if (packet == "qC")
+                return "QC1";
+            if (packet == "qfThreadInfo")
+                return "m1";
+            if (packet == "qsThreadInfo")
+                return "l";
+            if (packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0) {
+                char *end;
+                size_t offset = std::strtoul(packet.c_str() + 31, &end, 16);
+                size_t size = *end == ',' ? std::strtoul(end + 1, nullptr, 16) : 0;
+                std::string xml = TargetXML();
+                if (offset >= xml.size())
+                    return "l";
+                std::string chunk = xml.substr(offset, size);
+                return (offset + chunk.size() < xml.size() ? "m" : "l") + chunk;
+            }
+            return "";
+
+        default:
+            return "";
+        }
+    }
+
+    std::string GdbServer::StopReply() {
+        CPU &cpu = emulator.chipset.cpu;
+        if (watch_hit) {
+            const char *kind = watch_hit_type == '2' ? "watch" : watch_hit_type == '3' ? "rwatch" : "awatch";
+            char reply[48];
+            std::snprintf(reply, sizeof(reply), "T05%s:%zx;", kind, watch_hit_offset);
+            return reply;
+        }
+        size_t real_pc = cpu.GetCurrentRealPC();
+        if (breakpoints.count(real_pc))
+            return "T05swbreak:;";
+        return "S05";
+    }
+
+    std::string GdbServer::ReadRegisters() {
+        CPU &cpu = emulator.chipset.cpu;
+        std::string hex;
+        for (size_t ix = 0; ix != 16; ++ix)
+            hex += ToHex(cpu.reg_r[ix].raw, 1);
+        hex += ToHex(cpu.GetCurrentRealPC(), 4);
+        hex += ToHex(cpu.reg_sp.raw, 2);
+        hex += ToHex(cpu.reg_ea.raw, 2);
+        hex += ToHex(cpu.reg_psw.raw, 1);
+        hex += ToHex((uint32_t)cpu.reg_lcsr.raw << 16 | cpu.reg_lr.raw, 4);
+        return hex;
+    }
+
+    void GdbServer::WriteRegisters(const std::string &hex) {
+        CPU &cpu = emulator.chipset.cpu;
+        size_t pos = 0;
+        uint32_t value;
+        for (size_t ix = 0; ix != REGISTER_COUNT; pos += registers[ix].size * 2, ++ix) {
+            if (!FromHex(hex, pos, registers[ix].size, value))
+                return;
+            if (ix < 16)
+                cpu.reg_r[ix] = value;
+            else if (ix == 16) {
+                cpu.reg_csr = (value >> 16) & 0xF;
+                cpu.reg_pc = value & 0xFFFE;
+            } else if (ix == 17)
+                cpu.reg_sp = value;
+            else if (ix == 18)
+                cpu.reg_ea = value;
+            else if (ix == 19)
+                cpu.reg_psw = value;
+            else {
+                cpu.reg_lcsr = (value >> 16) & 0xF;
+                cpu.reg_lr = value & 0xFFFE;
+            }
+        }
+    }
+
+    std::string GdbServer::ReadMemory(size_t offset, size_t size) {
+        MMU &mmu = emulator.chipset.mmu;
+        std::string hex;
+        mmu.unobserved = true;
+        for (size_t ix = 0; ix != size; ++ix) {
+            size_t address = offset + ix;
+            if (address < CODE_BASE)
+                hex += ToHex(mmu.ReadData(address), 1);
+            else if (address < CODE_BASE + CODE_SIZE) {
+                address -= CODE_BASE;
+                hex += ToHex(mmu.ReadCode(address & ~1) >> ((address & 1) * 8), 1);
+            } else
+                break;
+        }
+        mmu.unobserved = false;
+        return hex.empty() && size ? "E01" : hex;
+    }
+
+    bool GdbServer::WriteMemory(size_t offset, const std::string &hex) {
+        size_t size = hex.size() / 2;
+        if (offset >= CODE_BASE || size > CODE_BASE - offset)
+            return false;
+        MMU &mmu = emulator.chipset.mmu;
+        uint32_t value;
+        for (size_t ix = 0; ix != size; ++ix)
+            if (!FromHex(hex, ix * 2, 1, value))
+                return false;
+        mmu.unobserved = true;
+        for (size_t ix = 0; ix != size; ++ix) {
+            FromHex(hex, ix * 2, 1, value);
+            mmu.WriteData(offset + ix, value);
+        }
+        mmu.unobserved = false;
+        return true;
+    }
+
+    bool GdbServer::SetPoint(char type, size_t offset, size_t size, bool enabled) {
+        CPU &cpu = emulator.chipset.cpu;
+        MMU &mmu = emulator.chipset.mmu;
+        if (type == '0' || type == '1') {
+            // Software and hardware breakpoints are the same thing here.
+            size_t real_pc = offset >= CODE_BASE ? offset - CODE_BASE : offset;
+            if (real_pc >= CODE_SIZE)
+                return false;
+            cpu.SetBreakpoint(real_pc, enabled);
+            if (enabled)
+                breakpoints.insert(real_pc & ~1);
+            else
+                breakpoints.erase(real_pc & ~1);
+            return true;
+        }
+
+        if (type < '2' || type > '4' || !size || offset >= CODE_BASE || size > CODE_BASE - offset)
+            return false;
+        if (!enabled) {
+            for (auto it = watchpoints.begin(); it != watchpoints.end(); ++it)
+                if (it->type == type && it->begin == offset && it->end == offset + size) {
+                    mmu.RemoveNativeWatches(&*it);
+                    watchpoints.erase(it);
+                    break;
+                }
+            return true;
+        }
+        watchpoints.push_back({this, offset, offset + size, type});
+        Watchpoint &watchpoint = watchpoints.back();
+        mmu.AddNativeWatch(offset, offset + size, type != '2' ? WatchHit : nullptr, type != '3' ? WatchHit : nullptr, &watchpoint);
+        return true;
+    }
+
+    void GdbServer::WatchHit(void *userdata, uint32_t offset, uint8_t) {
+        Watchpoint *watchpoint = (Watchpoint *)userdata;
+        GdbServer *server = watchpoint->server;
+        server->watch_hit = true;
+        server->watch_hit_type = watchpoint->type;
+        server->watch_hit_offset = offset;
+        server->emulator.SetPaused(true);
+    }
+
+    void GdbServer::ClearPoints() {
+        for (size_t real_pc : breakpoints)
+            emulator.chipset.cpu.SetBreakpoint(real_pc, false);
+        breakpoints.clear();
+        for (auto &watchpoint : watchpoints)
+            emulator.chipset.mmu.RemoveNativeWatches(&watchpoint);
+        watchpoints.clear();
+    }
+} // namespace casioemu
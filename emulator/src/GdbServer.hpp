@@ -0,0 +1,68 @@
+#pragma once
+#include "Config.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace casioemu {
+    class Emulator;
+
+    /**
+     * A stub for the GDB remote serial protocol, listening on 127.0.0.1 at the
+     * port given by the `gdb` key. One client is served at a time.
+     *
+     * The client sees the registers described by TARGET_XML, the data memory at
+     * addresses below 0x1000000 and the code memory (read only) at 0x1000000
+     * plus its real address. Breakpoints and watchpoints are set in the CPU and
+     * the MMU directly, so nothing runs per instruction on their behalf.
+     *
+     * The protocol runs on its own thread, which only touches the emulator with
+     * (access_mx) held. While the client has the target running, the emulator
+     * runs as usual and the thread polls for it to get paused.
+     */
+    class GdbServer {
+        Emulator &emulator;
+        std::thread thread;
+        std::atomic<bool> stopping;
+        unsigned short port;
+
+        /**
+         * Everything below is only accessed with (emulator.access_mx) held.
+         */
+        std::set<size_t> breakpoints;
+        struct Watchpoint {
+            GdbServer *server;
+            size_t begin, end;
+            char type; // '2' write, '3' read, '4' access, as in the Z packet
+        };
+        std::list<Watchpoint> watchpoints;
+        // Set by the watch functions when a watchpoint pauses the emulator.
+        bool watch_hit;
+        char watch_hit_type;
+        size_t watch_hit_offset;
+        static void WatchHit(void *userdata, uint32_t offset, uint8_t data);
+
+        void ServerMain();
+        /**
+         * Serve a connected client until it detaches or the emulator stops.
+         */
+        void Serve(std::intptr_t client);
+        std::string HandlePacket(const std::string &packet, bool &running, bool &detach);
+        std::string StopReply();
+        std::string ReadRegisters();
+        void WriteRegisters(const std::string &hex);
+        std::string ReadMemory(size_t offset, size_t size);
+        bool WriteMemory(size_t offset, const std::string &hex);
+        bool SetPoint(char type, size_t offset, size_t size, bool enabled);
+        void ClearPoints();
+
+    public:
+        GdbServer(Emulator &emulator, unsigned short port);
+        ~GdbServer();
+    };
+} // namespace casioemu
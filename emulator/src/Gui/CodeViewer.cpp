@@ -16,8 +16,6 @@
 #include <string>
 #include <thread>
 
-casioemu::Emulator *m_emu = nullptr;
-
 size_t get_real_pc(const CodeElem& e) {
     return get_real_pc(e.segment, e.offset);
 }
@@ -26,7 +24,7 @@ size_t get_real_pc(uint8_t seg, uint16_t off) {
     return (seg << 16) | off;
 }
 
-CodeViewer::CodeViewer(std::string path) {
+CodeViewer::CodeViewer(std::string path, casioemu::Emulator *_emu) : emu(_emu) {
     src_path = path;
     std::ifstream f(src_path, std::ios::in);
     if (!f.is_open())
@@ -88,21 +86,28 @@ bool CodeViewer::TryTrigBP(uint8_t seg, uint16_t offset, bool is_bp) {
         try_roll = true;
         return true;
     }
-    for (auto it = break_points.begin(); it != break_points.end(); it++) {
-        if (it->second == 1) {
-            CodeElem e = codes[it->first];
-            if (e.segment == seg && e.offset == offset) {
-                cur_row = it->first;
-                triggered_bp_line = it->first;
-                try_roll = true;
-                return true;
-            }
-        }
-    }
-    return false;
+    if (break_point_addresses.find(get_real_pc(seg, offset)) == break_point_addresses.end())
+        return false;
+    int idx = 0;
+    LookUp(seg, offset, &idx);
+    cur_row = idx;
+    triggered_bp_line = idx;
+    try_roll = true;
+    return true;
 }
 
-void CodeViewer::DrawContent() {
+void CodeViewer::SetBreakPoint(int line, bool enabled) {
+    break_points[line] = enabled;
+    size_t pc = get_real_pc(codes[line]);
+    emu->QueueDebugEdit([this, pc, enabled] {
+        if (enabled)
+            break_point_addresses.insert(pc);
+        else
+            break_point_addresses.erase(pc);
+    });
+}
+
+void CodeViewer::DrawContent(const casioemu::DebugState &state) {
     ImGuiListClipper c;
     c.Begin(max_row, ImGui::GetTextLineHeight());
     while (c.Step()) {
@@ -115,18 +120,18 @@ void CodeViewer::DrawContent() {
             } else if (it == break_points.end() || !break_points[line_i]) {
                 ImGui::Text("[ o ]");
                 if (ImGui::IsItemHovered() && ImGui::IsMouseClicked(0)) {
-                    break_points[line_i] = 1;
+                    SetBreakPoint(line_i, true);
                 }
             } else {
                 ImGui::TextColored(ImVec4(1.0, 0.0, 0.0, 1.0), "[ x ]");
                 if (ImGui::IsItemHovered() && ImGui::IsMouseClicked(0)) {
-                    break_points[line_i] = 0;
+                    SetBreakPoint(line_i, false);
                 }
             }
             ImGui::SameLine();
             ImGui::TextColored(ImVec4(1.0, 1.0, 0.0, 1.0), "%05zX", get_real_pc(e));
             ImGui::SameLine();
-            if (m_emu->chipset.cpu.GetCurrentRealPC() == get_real_pc(e))
+            if (get_real_pc(state.reg_csr, state.reg_pc) == get_real_pc(e))
                 ImGui::TextColored(ImVec4(0.0, 1.0, 0.0, 1.0), "%s", e.srcbuf);
             else
                 ImGui::Text("%s", e.srcbuf);
@@ -141,9 +146,7 @@ void CodeViewer::DrawContent() {
     }
 }
 
-static bool step_debug = false, trace_debug = false;
-
-void CodeViewer::DrawWindow() {
+void CodeViewer::DrawWindow(const casioemu::DebugState &state) {
     int h = ImGui::GetTextLineHeight() + 4;
     int w = ImGui::CalcTextSize("F").x;
     if (!is_loaded) {
@@ -157,7 +160,7 @@ void CodeViewer::DrawWindow() {
     }
     ImGui::Begin("Disassembly", 0);
     ImGui::BeginChild("##scrolling", ImVec2(0, -ImGui::GetTextLineHeight() * 1.8f));
-    DrawContent();
+    DrawContent(state);
     ImGui::EndChild();
     ImGui::Text("Go to Addr:");
     ImGui::SameLine();
@@ -171,12 +174,14 @@ void CodeViewer::DrawWindow() {
     ImGui::Checkbox("STEP", &step_debug);
     ImGui::SameLine();
     ImGui::Checkbox("TRACE", &trace_debug);
-    if (m_emu->GetPaused()) {
+    if (state.paused) {
         ImGui::SameLine();
         if (ImGui::Button("Continue")) {
-            if (!step_debug && !trace_debug)
-                break_points[triggered_bp_line] = 0;
-            m_emu->SetPaused(false);
+            if (!step_debug && !trace_debug && triggered_bp_line >= 0)
+                SetBreakPoint(triggered_bp_line, false);
+            emu->QueueDebugEdit([this] {
+                emu->SetPaused(false);
+            });
             triggered_bp_line = -1;
         }
     }
@@ -1,8 +1,11 @@
 #pragma once
+#include "../Data/DebugState.hpp"
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -23,29 +26,41 @@ enum EmuDebugFlag {
     DEBUG_RET_TRACE = 4
 };
 
+namespace casioemu {
+    class Emulator;
+}
+
 class CodeViewer {
 private:
+    casioemu::Emulator *emu;
+    // Owned by the GUI thread.
     std::map<int, uint8_t> break_points;
+    // Owned by the emulation thread, updated through Emulator::QueueDebugEdit.
+    std::set<size_t> break_point_addresses;
     std::vector<CodeElem> codes;
     size_t rows;
     std::string src_path;
     char adrbuf[9]{0};
     int max_row = 0;
     int max_col = 0;
-    int cur_row = 0;
+    // Written by the emulation thread when a break point triggers.
+    std::atomic<int> cur_row{0};
 
     bool is_loaded = false;
-    bool try_roll = false;
-    int64_t triggered_bp_line = -1;
+    bool step_debug = false, trace_debug = false;
+    std::atomic<bool> try_roll{false};
+    std::atomic<int> triggered_bp_line{-1};
+
+    void SetBreakPoint(int line, bool enabled);
 
 public:
-    uint8_t debug_flags = DEBUG_BREAKPOINT;
-    CodeViewer(std::string path);
+    std::atomic<uint8_t> debug_flags{DEBUG_BREAKPOINT};
+    CodeViewer(std::string path, casioemu::Emulator *emu);
     ~CodeViewer();
     bool TryTrigBP(uint8_t seg, uint16_t offset, bool bp_mode = true);
     CodeElem LookUp(uint8_t seg, uint16_t offset, int *idx = nullptr);
-    void DrawWindow();
-    void DrawContent();
+    void DrawWindow(const casioemu::DebugState &state);
+    void DrawContent(const casioemu::DebugState &state);
     void DrawMonitor();
     void JumpTo(uint8_t seg, uint16_t offset);
 };
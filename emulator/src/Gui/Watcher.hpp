@@ -7,5 +7,5 @@ private:
     casioemu::Emulator* emu;
 public:
     Watcher(casioemu::Emulator *_emu): emu(_emu) {}
-    void DrawWindow();
+    void DrawWindow(const casioemu::DebugState &state);
 };
@@ -1,4 +1,6 @@
+#include "../Chipset/Chipset.hpp"
 #include "../Data/HardwareId.hpp"
+#include "../Peripheral/BatteryBackedRAM.hpp"
 #include "CodeViewer.hpp"
 #include "Watcher.hpp"
 #include "SDL_timer.h"
@@ -12,9 +14,9 @@
 
 #include "hex.hpp"
 
-char *n_ram_buffer = nullptr;
-CodeViewer *code_viewer = nullptr;
-Watcher *watcher = nullptr;
+static casioemu::Emulator *m_emu = nullptr;
+static CodeViewer *code_viewer = nullptr;
+static Watcher *watcher = nullptr;
 
 static SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
 static SDL_Window *window;
@@ -31,14 +33,22 @@ void debugger_gui_loop() {
     ImGui_ImplSDL2_NewFrame();
     ImGui::NewFrame();
 
+    // Everything below reads from this copy only, the emulation thread keeps running meanwhile.
+    m_emu->debug_state.Fetch();
+    casioemu::DebugState &state = m_emu->debug_state.Front();
+
     static MemoryEditor mem_edit;
-    if (n_ram_buffer != nullptr) {
-        size_t base = m_emu->hardware_id == casioemu::HW_ES_PLUS ? 0x8000 : 0xD000;
-        size_t size = m_emu->hardware_id == casioemu::HW_ES_PLUS ? 0x0E00 : 0x2000;
-        mem_edit.DrawWindow("RAM Editor", n_ram_buffer, size, base);
+    if (!state.ram.empty()) {
+        mem_edit.WriteFn = [](ImU8 *data, size_t offset, ImU8 value) {
+            data[offset] = value; // show the new value until the next snapshot arrives
+            m_emu->QueueDebugEdit([offset, value] {
+                m_emu->chipset.battery_backed_ram->ram_buffer[offset] = value;
+            });
+        };
+        mem_edit.DrawWindow("RAM Editor", state.ram.data(), state.ram.size(), state.ram_base);
     }
-    code_viewer->DrawWindow();
-    watcher->DrawWindow();
+    code_viewer->DrawWindow(state);
+    watcher->DrawWindow(state);
 
     // Rendering
     ImGui::Render();
@@ -49,7 +59,9 @@ void debugger_gui_loop() {
     SDL_RenderPresent(renderer);
 }
 
-int init_debugger_window() {
+int init_debugger_window(casioemu::Emulator &emulator) {
+    m_emu = &emulator;
+
     window = SDL_CreateWindow("CasioEmuX Debugger", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 900, 600, window_flags);
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_ACCELERATED);
     if (renderer == nullptr) {
@@ -71,8 +83,10 @@ int init_debugger_window() {
     ImGui_ImplSDL2_InitForSDLRenderer(window, renderer);
     ImGui_ImplSDLRenderer2_Init(renderer);
 
-    code_viewer = new CodeViewer(m_emu->GetModelFilePath("_disas.txt"));
+    code_viewer = new CodeViewer(m_emu->GetModelFilePath("_disas.txt"), m_emu);
     watcher = new Watcher(m_emu);
+    m_emu->code_viewer = code_viewer;
+    m_emu->publish_debug_state = true;
 
     return 0;
 }
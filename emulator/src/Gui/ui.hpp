@@ -3,9 +3,8 @@
 #include "CodeViewer.hpp"
 #include "Watcher.hpp"
 
-int init_debugger_window();
+/**
+ * The debugger window is attached to exactly one emulator, which is not owned by it.
+ */
+int init_debugger_window(casioemu::Emulator &emulator);
 void debugger_gui_loop();
-extern char *n_ram_buffer;
-extern casioemu::Emulator *m_emu;
-extern CodeViewer *code_viewer;
-extern Watcher *watcher;
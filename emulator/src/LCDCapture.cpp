@@ -0,0 +1,392 @@
+#include "LCDCapture.hpp"
+
+#include "Chipset/Chipset.hpp"
+#include "Emulator.hpp"
+#include "Logger.hpp"
+#include "Peripheral/Screen.hpp"
+
+#include <SDL.h>
+#include <SDL_image.h>
+#include <array>
+#include <cstring>
+
+namespace casioemu {
+    static const char CAPTURE_MAGIC[4] = {'C', 'L', 'C', 'D'};
+    static const uint8_t CAPTURE_VERSION = 1;
+    static const size_t CAPTURE_HEADER_SIZE = 16, SAMPLE_HEADER_SIZE = 12;
+
+    static void PutLE(std::vector<uint8_t> &out, uint64_t value, int bytes) {
+        for (int ix = 0; ix != bytes; ++ix)
+            out.push_back(value >> (ix * 8));
+    }
+
+    static uint64_t GetLE(const uint8_t *in, int bytes) {
+        uint64_t value = 0;
+        for (int ix = 0; ix != bytes; ++ix)
+            value |= (uint64_t)in[ix] << (ix * 8);
+        return value;
+    }
+
+    static void PutLEB128(std::vector<uint8_t> &out, size_t value) {
+        while (value >= 0x80) {
+            out.push_back((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(value);
+    }
+
+    static bool GetBit(const std::vector<uint8_t> &dots, size_t index) {
+        return dots[index / 8] & (0x80 >> (index % 8));
+    }
+
+    LCDCapture::LCDCapture(Emulator &_emulator, const std::string &_path, unsigned int _every_frames) : emulator(_emulator), path(_path), stopping(false) {
+        png = path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+        every_frames = _every_frames ? _every_frames : 1;
+        frames_left = 0;
+        captured_any = false;
+        captured_version = 0;
+        dropped = 0;
+
+        ScreenBase &screen = *emulator.chipset.screen;
+        width = screen.GetWidth();
+        height = screen.GetHeight();
+        cycles_per_second = emulator.GetCyclesPerSecond();
+        stream = nullptr;
+        written_any = false;
+    }
+
+    LCDCapture::~LCDCapture() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> wake_lock(encoder_wake_mx);
+                stopping = true;
+            }
+            encoder_wake_cv.notify_one();
+            thread.join();
+        }
+        if (stream)
+            std::fclose(stream);
+        if (dropped)
+            logger::Info("capture to '%s' dropped %zu samples\n", path.c_str(), dropped);
+    }
+
+    bool LCDCapture::Start(std::string &error) {
+        if (!png) {
+            stream = std::fopen(path.c_str(), "wb");
+            if (!stream) {
+                error = "cannot open '" + path + "' for writing";
+                return false;
+            }
+            std::vector<uint8_t> header(CAPTURE_MAGIC, CAPTURE_MAGIC + 4);
+            header.push_back(CAPTURE_VERSION);
+            PutLE(header, 0, 3);
+            PutLE(header, width, 2);
+            PutLE(header, height, 2);
+            PutLE(header, cycles_per_second, 4);
+            std::fwrite(header.data(), 1, header.size(), stream);
+        }
+
+        thread = std::thread([this] {
+            EncoderMain();
+        });
+        return true;
+    }
+
+    void LCDCapture::Frame() {
+        if (frames_left) {
+            --frames_left;
+            return;
+        }
+        frames_left = every_frames - 1;
+
+        ScreenBase &screen = *emulator.chipset.screen;
+        uint64_t version = screen.GetVersion();
+        if (captured_any && version == captured_version)
+            return;
+
+        Sample *sample = queue.Back();
+        if (!sample) {
+            ++dropped;
+            return;
+        }
+        captured_any = true;
+        captured_version = version;
+        sample->cycles = emulator.cycle_count;
+        screen.ReadDots(sample->dots);
+        queue.Push();
+        {
+            // Taking the lock keeps the encoder from missing the wakeup between
+            // finding the queue empty and going to sleep.
+            std::lock_guard<std::mutex> wake_lock(encoder_wake_mx);
+        }
+        encoder_wake_cv.notify_one();
+    }
+
+    void LCDCapture::EncoderMain() {
+        while (1) {
+            Sample *sample = queue.Front();
+            if (!sample) {
+                // Everything pushed before (stopping) was set is visible by now.
+                if (stopping && !queue.Front())
+                    return;
+                std::unique_lock<std::mutex> wake_lock(encoder_wake_mx);
+                encoder_wake_cv.wait(wake_lock, [this] {
+                    return queue.Front() || stopping;
+                });
+                continue;
+            }
+
+            // Register writes change the version without changing what's shown.
+            if (!written_any || sample->dots != previous) {
+                if (png)
+                    WritePNG(*sample);
+                else
+                    WriteStreamSample(*sample);
+                previous = sample->dots;
+                written_any = true;
+            }
+            queue.Pop();
+        }
+    }
+
+    void LCDCapture::WritePNG(const Sample &sample) {
+        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (!surface) {
+            logger::Info("capture: SDL_CreateRGBSurfaceWithFormat failed: %s\n", SDL_GetError());
+            return;
+        }
+        for (int iy = 0; iy != height; ++iy) {
+            uint32_t *row = (uint32_t *)((uint8_t *)surface->pixels + iy * surface->pitch);
+            for (int ix = 0; ix != width; ++ix)
+                row[ix] = GetBit(sample.dots, iy * width + ix) ? 0xFF000000 : 0xFFFFFFFF;
+        }
+
+        char suffix[32];
+        std::snprintf(suffix, sizeof(suffix), "_%09llu.png", (unsigned long long)(sample.cycles * 1000 / cycles_per_second));
+        std::string file = path.substr(0, path.size() - 4) + suffix;
+        if (IMG_SavePNG(surface, file.c_str()))
+            logger::Info("capture: IMG_SavePNG failed: %s\n", IMG_GetError());
+        SDL_FreeSurface(surface);
+    }
+
+    void LCDCapture::WriteStreamSample(const Sample &sample) {
+        std::vector<uint8_t> runs;
+        size_t dot_count = (size_t)width * height, run_start = 0;
+        bool changed = false;
+        for (size_t ix = 0; ix != dot_count; ++ix) {
+            bool dot_changed = GetBit(sample.dots, ix) != (written_any && GetBit(previous, ix));
+            if (dot_changed != changed) {
+                PutLEB128(runs, ix - run_start);
+                run_start = ix;
+                changed = dot_changed;
+            }
+        }
+        PutLEB128(runs, dot_count - run_start);
+
+        std::vector<uint8_t> header;
+        PutLE(header, sample.cycles, 8);
+        PutLE(header, runs.size(), 4);
+        std::fwrite(header.data(), 1, header.size(), stream);
+        std::fwrite(runs.data(), 1, runs.size(), stream);
+        std::fflush(stream);
+    }
+
+    /**
+     * Packs GIF LZW codes into bytes, least significant bit first.
+     */
+    struct GIFCodeWriter {
+        std::vector<uint8_t> bytes;
+        uint32_t bits = 0;
+        int bit_count = 0;
+
+        void Write(uint32_t code, int size) {
+            bits |= code << bit_count;
+            bit_count += size;
+            while (bit_count >= 8) {
+                bytes.push_back(bits);
+                bits >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        void Flush() {
+            if (bit_count)
+                bytes.push_back(bits);
+            bits = 0;
+            bit_count = 0;
+        }
+    };
+
+    static void WriteGIFImage(std::vector<uint8_t> &out, const std::vector<uint8_t> &pixels) {
+        const int MIN_CODE_SIZE = 2;
+        const uint32_t CLEAR_CODE = 1 << MIN_CODE_SIZE;
+
+        // (tree[code][pixel]) is the code for the string of (code) followed by (pixel), or 0.
+        std::vector<std::array<uint16_t, 2>> tree(4096);
+        GIFCodeWriter writer;
+        int code_size = MIN_CODE_SIZE + 1;
+        uint32_t max_code = CLEAR_CODE + 1;
+        writer.Write(CLEAR_CODE, code_size);
+
+        uint32_t current = pixels[0];
+        for (size_t ix = 1; ix != pixels.size(); ++ix) {
+            uint8_t pixel = pixels[ix];
+            if (tree[current][pixel]) {
+                current = tree[current][pixel];
+                continue;
+            }
+            writer.Write(current, code_size);
+            tree[current][pixel] = ++max_code;
+            if (max_code >= (1u << code_size))
+                ++code_size;
+            if (max_code == 4095) {
+                writer.Write(CLEAR_CODE, code_size);
+                std::fill(tree.begin(), tree.end(), std::array<uint16_t, 2>{});
+                code_size = MIN_CODE_SIZE + 1;
+                max_code = CLEAR_CODE + 1;
+            }
+            current = pixel;
+        }
+        writer.Write(current, code_size);
+        writer.Write(CLEAR_CODE, code_size);
+        writer.Write(CLEAR_CODE + 1, MIN_CODE_SIZE + 1);
+        writer.Flush();
+
+        out.push_back(MIN_CODE_SIZE);
+        for (size_t ix = 0; ix < writer.bytes.size(); ix += 255) {
+            size_t block_size = std::min<size_t>(255, writer.bytes.size() - ix);
+            out.push_back(block_size);
+            out.insert(out.end(), writer.bytes.begin() + ix, writer.bytes.begin() + ix + block_size);
+        }
+        out.push_back(0);
+    }
+
+    bool LCDCapture::ConvertToGIF(const std::string &stream_path, const std::string &gif_path, int scale, std::string &error) {
+        FILE *in = std::fopen(stream_path.c_str(), "rb");
+        if (!in) {
+            error = "cannot open '" + stream_path + "'";
+            return false;
+        }
+        std::vector<uint8_t> data;
+        uint8_t buffer[4096];
+        size_t read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), in)))
+            data.insert(data.end(), buffer, buffer + read);
+        std::fclose(in);
+
+        if (data.size() < CAPTURE_HEADER_SIZE || std::memcmp(data.data(), CAPTURE_MAGIC, 4) || data[4] != CAPTURE_VERSION) {
+            error = "'" + stream_path + "' is not a capture stream";
+            return false;
+        }
+        int width = GetLE(&data[8], 2), height = GetLE(&data[10], 2);
+        uint64_t cycles_per_second = GetLE(&data[12], 4);
+        size_t dot_count = (size_t)width * height;
+        if (!dot_count || width % 8 || !cycles_per_second) {
+            error = "'" + stream_path + "' has a broken header";
+            return false;
+        }
+
+        // Decode every sample, with its time in centiseconds.
+        std::vector<std::vector<uint8_t>> samples;
+        std::vector<uint64_t> times;
+        std::vector<uint8_t> dots(dot_count / 8);
+        for (size_t offset = CAPTURE_HEADER_SIZE; offset != data.size();) {
+            if (data.size() - offset < SAMPLE_HEADER_SIZE) {
+                error = "'" + stream_path + "' is truncated";
+                return false;
+            }
+            uint64_t cycles = GetLE(&data[offset], 8);
+            size_t size = GetLE(&data[offset + 8], 4);
+            offset += SAMPLE_HEADER_SIZE;
+            if (data.size() - offset < size) {
+                error = "'" + stream_path + "' is truncated";
+                return false;
+            }
+
+            size_t end = offset + size, position = 0;
+            bool changed = false;
+            while (offset != end) {
+                size_t length = 0;
+                for (int shift = 0; offset != end && shift < 64; shift += 7) {
+                    uint8_t byte = data[offset++];
+                    length |= (size_t)(byte & 0x7F) << shift;
+                    if (!(byte & 0x80))
+                        break;
+                }
+                if (length > dot_count - position) {
+                    error = "'" + stream_path + "' has a broken sample";
+                    return false;
+                }
+                if (changed)
+                    for (size_t ix = position; ix != position + length; ++ix)
+                        dots[ix / 8] ^= 0x80 >> (ix % 8);
+                position += length;
+                changed = !changed;
+            }
+
+            uint64_t time = cycles * 100 / cycles_per_second;
+            // A sample shown for less than a centisecond is replaced by the next one.
+            if (!times.empty() && times.back() == time) {
+                samples.back() = dots;
+                continue;
+            }
+            samples.push_back(dots);
+            times.push_back(time);
+        }
+        if (samples.empty()) {
+            error = "'" + stream_path + "' holds no samples";
+            return false;
+        }
+
+        if (scale < 1)
+            scale = 1;
+        int gif_width = width * scale, gif_height = height * scale;
+        if (gif_width > 0xFFFF || gif_height > 0xFFFF) {
+            error = "scale is too large";
+            return false;
+        }
+
+        std::vector<uint8_t> out = {'G', 'I', 'F', '8', '9', 'a'};
+        PutLE(out, gif_width, 2);
+        PutLE(out, gif_height, 2);
+        // A global colour table of 2 entries: clear dots white, set dots black.
+        out.insert(out.end(), {0x80, 0, 0, 0xFF, 0xFF, 0xFF, 0, 0, 0});
+        // Loop forever.
+        out.insert(out.end(), {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0, 0, 0});
+
+        std::vector<uint8_t> pixels((size_t)gif_width * gif_height);
+        for (size_t index = 0; index != samples.size(); ++index) {
+            // The last sample stays for two seconds before the animation starts over.
+            uint64_t delay = index + 1 != samples.size() ? times[index + 1] - times[index] : 200;
+            if (delay > 0xFFFF)
+                delay = 0xFFFF;
+            out.insert(out.end(), {0x21, 0xF9, 0x04, 0x04});
+            PutLE(out, delay, 2);
+            out.insert(out.end(), {0, 0});
+
+            out.push_back(0x2C);
+            PutLE(out, 0, 4);
+            PutLE(out, gif_width, 2);
+            PutLE(out, gif_height, 2);
+            out.push_back(0);
+
+            for (int iy = 0; iy != gif_height; ++iy)
+                for (int ix = 0; ix != gif_width; ++ix)
+                    pixels[(size_t)iy * gif_width + ix] = GetBit(samples[index], (iy / scale) * width + ix / scale);
+            WriteGIFImage(out, pixels);
+        }
+        out.push_back(0x3B);
+
+        FILE *gif = std::fopen(gif_path.c_str(), "wb");
+        if (!gif) {
+            error = "cannot open '" + gif_path + "' for writing";
+            return false;
+        }
+        bool written = std::fwrite(out.data(), 1, out.size(), gif) == out.size();
+        if (std::fclose(gif) || !written) {
+            error = "failed to write '" + gif_path + "'";
+            return false;
+        }
+        return true;
+    }
+} // namespace casioemu
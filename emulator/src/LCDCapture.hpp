@@ -0,0 +1,90 @@
+#pragma once
+#include "Config.hpp"
+
+#include "Data/SPSCQueue.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace casioemu {
+    class Emulator;
+
+    /**
+     * Records what the dot matrix shows every (every_frames) emulated frames,
+     * as long as it changed since the last sample. If (path) ends in ".png",
+     * every sample is written to its own PNG file, named after (path) and the
+     * emulated time in milliseconds ("out.png" becomes "out_000001234.png").
+     * Otherwise all samples go to a single capture stream:
+     *
+     *   header: "CLCD", uint8 version (1), 3 reserved bytes,
+     *           uint16 width, uint16 height, uint32 cycles per second
+     *   sample: uint64 cycle count, uint32 size, (size) bytes of runs
+     *
+     * All integers are little endian. The runs describe the dots of the sample
+     * XOR those of the previous one (all clear for the first), read row by row
+     * and from the left: alternating runs of unchanged and changed dots,
+     * starting with an unchanged one, each length written as an unsigned
+     * LEB128 number.
+     *
+     * Frame() only copies the dots into a queue, a thread of its own does the
+     * encoding and writing. If that thread falls behind by more than the queue
+     * holds, samples are dropped rather than making emulation wait. The thread
+     * sleeps on (encoder_wake_cv) while the queue is empty.
+     */
+    class LCDCapture {
+        Emulator &emulator;
+        std::string path;
+        bool png;
+        unsigned int every_frames, frames_left;
+        bool captured_any;
+        uint64_t captured_version;
+        size_t dropped;
+
+        struct Sample {
+            uint64_t cycles;
+            std::vector<uint8_t> dots;
+        };
+        SPSCQueue<Sample, 64> queue;
+        std::atomic<bool> stopping;
+        std::thread thread;
+        std::mutex encoder_wake_mx;
+        std::condition_variable encoder_wake_cv;
+
+        /**
+         * Only accessed by the encoding thread once it's started.
+         */
+        int width, height;
+        unsigned int cycles_per_second;
+        FILE *stream;
+        std::vector<uint8_t> previous;
+        bool written_any;
+        void EncoderMain();
+        void WritePNG(const Sample &sample);
+        void WriteStreamSample(const Sample &sample);
+
+    public:
+        LCDCapture(Emulator &emulator, const std::string &path, unsigned int every_frames);
+        ~LCDCapture();
+        /**
+         * Open the stream and start the encoding thread. Returns false and sets
+         * (error) if the stream can't be written.
+         */
+        bool Start(std::string &error);
+        /**
+         * Called at the end of every emulated frame, with (access_mx) held.
+         */
+        void Frame();
+
+        /**
+         * Convert a capture stream into an animated GIF, every dot drawn as a
+         * (scale) by (scale) square. Returns false and sets (error) on failure.
+         */
+        static bool ConvertToGIF(const std::string &stream_path, const std::string &gif_path, int scale, std::string &error);
+    };
+} // namespace casioemu
@@ -3,14 +3,22 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include <mutex>
+
 #include <readline/readline.h>
 
 namespace casioemu {
     namespace logger {
+        static std::mutex output_mx;
+        static thread_local std::string thread_prefix;
+
         void Info(const char *format, ...) {
-            // * TODO may introduce race condition
+            std::lock_guard<std::mutex> output_lock(output_mx);
+            // * TODO may still race with readline redrawing the prompt on the console thread
             if (RL_ISSTATE(RL_STATE_READCMD))
                 rl_clear_visible_line();
+            if (!thread_prefix.empty())
+                fputs(thread_prefix.c_str(), stdout);
             va_list args;
             va_start(args, format);
             vprintf(format, args);
@@ -20,5 +28,9 @@ namespace casioemu {
                 rl_redisplay();
             }
         }
+
+        void SetThreadPrefix(std::string prefix) {
+            thread_prefix = std::move(prefix);
+        }
     }
 } // namespace casioemu
@@ -7,5 +7,7 @@ namespace casioemu {
     namespace logger {
         // Note that the printed string should end with a new line character.
         void Info(const char *format, ...);
+        // Prepended to every message logged from the calling thread. Used to tell pooled emulators apart.
+        void SetThreadPrefix(std::string prefix);
     }
 }
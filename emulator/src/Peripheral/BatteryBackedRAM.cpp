@@ -3,9 +3,10 @@
 #include "../Chipset/Chipset.hpp"
 #include "../Chipset/MMU.hpp"
 #include "../Data/HardwareId.hpp"
+#include "../Data/StateStream.hpp"
 #include "../Emulator.hpp"
-#include "../Gui/ui.hpp"
 #include "../Logger.hpp"
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 
@@ -23,10 +24,7 @@ namespace casioemu {
         if (!real_hardware)
             ram_size += 0x100;
 
-        ram_buffer = new uint8_t[ram_size];
-        for (size_t ix = 0; ix != ram_size; ++ix)
-            ram_buffer[ix] = 0;
-
+        ram_buffer = nullptr;
         ram_file_requested = false;
         if (emulator.argv_map.find("ram") != emulator.argv_map.end()) {
             ram_file_requested = true;
@@ -34,6 +32,12 @@ namespace casioemu {
                 LoadRAMImage();
         }
 
+        if (!ram_buffer) {
+            ram_buffer = new uint8_t[ram_size];
+            for (size_t ix = 0; ix != ram_size; ++ix)
+                ram_buffer[ix] = 0;
+        }
+
         region.Setup(
             emulator.hardware_id == HW_ES_PLUS ? 0x8000 : 0xD000,
             emulator.hardware_id == HW_ES_PLUS ? 0x0E00 : 0x2000,
@@ -51,17 +55,66 @@ namespace casioemu {
                 [](MMURegion *region, size_t offset) { return ((uint8_t *)region->userdata)[offset - region->base]; },
                 [](MMURegion *region, size_t offset, uint8_t data) { ((uint8_t *)region->userdata)[offset - region->base] = data; },
                 emulator);
-        n_ram_buffer = (char *)ram_buffer;
+        region.direct = ram_buffer;
+        if (region_2.setup_done)
+            region_2.direct = ram_buffer + ram_size - 0x100;
         logger::Info("inited RAM!\n");
     }
 
     void BatteryBackedRAM::Uninitialise() {
-        if (ram_file_requested && emulator.argv_map.find("preserve_ram") == emulator.argv_map.end())
+        // Headless instances run in a pool whose siblings may still map the same file, so they never write it back.
+        if (ram_file_requested && emulator.argv_map.find("preserve_ram") == emulator.argv_map.end() && !emulator.Headless())
             SaveRAMImage();
-        delete[] ram_buffer;
+        if (ram_image.GetData())
+            ram_image.Close();
+        else
+            delete[] ram_buffer;
+    }
+
+    void BatteryBackedRAM::ReleaseRAMImage() {
+        if (!ram_image.GetData())
+            return;
+
+        uint8_t *copy = new uint8_t[ram_size];
+        std::memcpy(copy, ram_buffer, ram_size);
+        ram_image.Close();
+
+        ram_buffer = copy;
+        region.userdata = ram_buffer;
+        region.direct = ram_buffer;
+        if (region_2.setup_done) {
+            region_2.userdata = ram_buffer + ram_size - 0x100;
+            region_2.direct = ram_buffer + ram_size - 0x100;
+        }
+    }
+
+    void BatteryBackedRAM::SaveState(StateWriter &writer) {
+        writer.WriteBytes(ram_buffer, ram_size);
+    }
+
+    void BatteryBackedRAM::LoadState(StateReader &reader) {
+        // Writing only touches the pages that differ, so a mapped RAM image stays mostly shared.
+        uint8_t page[0x100];
+        for (size_t offset = 0; offset < ram_size; offset += sizeof(page)) {
+            size_t count = std::min(sizeof(page), ram_size - offset);
+            reader.ReadBytes(page, count);
+            if (std::memcmp(ram_buffer + offset, page, count))
+                std::memcpy(ram_buffer + offset, page, count);
+        }
+    }
+
+    size_t BatteryBackedRAM::GetBase() {
+        return region.base;
+    }
+
+    size_t BatteryBackedRAM::GetSize() {
+        return region.size;
     }
 
     void BatteryBackedRAM::SaveRAMImage() {
+        // The file cannot be rewritten while it is still mapped, so move the RAM to the heap first.
+        ReleaseRAMImage();
+
         std::ofstream ram_handle(emulator.argv_map["ram"], std::ofstream::binary);
         if (ram_handle.fail()) {
             logger::Info("[BatteryBackedRAM] std::ofstream failed: %s\n", std::strerror(errno));
@@ -75,6 +128,21 @@ namespace casioemu {
     }
 
     void BatteryBackedRAM::LoadRAMImage() {
+        // Mapping the file means instances started from the same RAM file share it until they write to it.
+        if (!ram_buffer && ram_image.Open(emulator.argv_map["ram"], MappedFile::MF_COPY_ON_WRITE)) {
+            if (ram_image.GetSize() >= ram_size) {
+                ram_buffer = ram_image.GetData();
+                return;
+            }
+            ram_image.Close();
+        }
+
+        if (!ram_buffer) {
+            ram_buffer = new uint8_t[ram_size];
+            for (size_t ix = 0; ix != ram_size; ++ix)
+                ram_buffer[ix] = 0;
+        }
+
         std::ifstream ram_handle(emulator.argv_map["ram"], std::ifstream::binary);
         if (ram_handle.fail()) {
             logger::Info("[BatteryBackedRAM] std::ifstream failed: %s\n", std::strerror(errno));
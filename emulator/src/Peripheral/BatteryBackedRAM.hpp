@@ -2,6 +2,7 @@
 #include "../Config.hpp"
 
 #include "../Chipset/MMURegion.hpp"
+#include "../Data/MappedFile.hpp"
 #include "Peripheral.hpp"
 
 namespace casioemu {
@@ -10,6 +11,14 @@ namespace casioemu {
 
         size_t ram_size;
         bool ram_file_requested;
+        /**
+         * If the RAM file is at least (ram_size) bytes long, (ram_buffer) points
+         * into a copy-on-write mapping of it. Otherwise (ram_buffer) is allocated
+         * with new[].
+         */
+        MappedFile ram_image;
+
+        void ReleaseRAMImage();
 
     public:
         using Peripheral::Peripheral;
@@ -18,5 +27,14 @@ namespace casioemu {
         void Uninitialise();
         void SaveRAMImage();
         void LoadRAMImage();
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
+
+        /**
+         * Location of the main RAM region. The additional region used by the ROMs
+         * of Casio's emulators is not included.
+         */
+        size_t GetBase();
+        size_t GetSize();
     };
 }
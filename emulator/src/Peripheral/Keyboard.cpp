@@ -3,16 +3,20 @@
 #include "../Chipset/Chipset.hpp"
 #include "../Chipset/MMU.hpp"
 #include "../Data/HardwareId.hpp"
+#include "../Data/StateStream.hpp"
 #include "../Emulator.hpp"
 #include "../Logger.hpp"
 
 #include <SDL.h>
+#include <cstdlib>
+#include <cstring>
 #include <lua.hpp>
 
 namespace casioemu {
     void Keyboard::Initialise() {
         renderer = emulator.GetRenderer();
         require_frame = true;
+        drawn_overlays.fill(OV_NONE);
 
         /*
          * When real_hardware is false, the program should emulate the behavior of the
@@ -136,6 +140,7 @@ namespace casioemu {
                 button.rect.y = lua_tointeger(emulator.lua_state, -4);
                 button.rect.w = lua_tointeger(emulator.lua_state, -3);
                 button.rect.h = lua_tointeger(emulator.lua_state, -2);
+                button.code = code;
                 button.ko_bit = 1 << ((code >> 4) & 0xF);
                 button.ki_bit = 1 << (code & 0xF);
 
@@ -147,6 +152,26 @@ namespace casioemu {
 
             lua_pop(emulator.lua_state, 2);
         }
+
+        {
+            // key_names is optional and maps any name to a button_map code, e.g. ["+"] = 0x31.
+            key_names.clear();
+            const char *key = "key_names";
+            lua_geti(emulator.lua_state, LUA_REGISTRYINDEX, emulator.lua_model_ref);
+            int type = lua_getfield(emulator.lua_state, -1, key);
+            if (type != LUA_TNIL && type != LUA_TTABLE)
+                PANIC("key '%s' is not a table\n", key);
+            if (type == LUA_TTABLE) {
+                lua_pushnil(emulator.lua_state);
+                while (lua_next(emulator.lua_state, -2)) {
+                    if (lua_type(emulator.lua_state, -2) != LUA_TSTRING || !lua_isinteger(emulator.lua_state, -1))
+                        PANIC("key '%s' must map strings to integers\n", key);
+                    key_names[lua_tostring(emulator.lua_state, -2)] = lua_tointeger(emulator.lua_state, -1);
+                    lua_pop(emulator.lua_state, 1);
+                }
+            }
+            lua_pop(emulator.lua_state, 2);
+        }
     }
 
     void Keyboard::Reset() {
@@ -164,23 +189,87 @@ namespace casioemu {
         RecalculateGhost();
     }
 
+    void Keyboard::SaveState(StateWriter &writer) {
+        writer.Write(keyboard_out);
+        writer.Write(keyboard_out_mask);
+        writer.Write(keyboard_in);
+        writer.Write(input_filter);
+        writer.Write(keyboard_ghost);
+        writer.Write(keyboard_ready_emu);
+        writer.Write(keyboard_out_emu);
+        writer.Write(keyboard_in_emu);
+        writer.Write(has_input);
+        writer.Write(p0);
+        writer.Write(p1);
+        writer.Write(p146);
+        for (auto &button : buttons) {
+            writer.Write(button.pressed);
+            writer.Write(button.stuck);
+        }
+        interrupt_source.SaveState(writer);
+    }
+
+    void Keyboard::LoadState(StateReader &reader) {
+        reader.Read(keyboard_out);
+        reader.Read(keyboard_out_mask);
+        reader.Read(keyboard_in);
+        reader.Read(input_filter);
+        reader.Read(keyboard_ghost);
+        reader.Read(keyboard_ready_emu);
+        reader.Read(keyboard_out_emu);
+        reader.Read(keyboard_in_emu);
+        reader.Read(has_input);
+        reader.Read(p0);
+        reader.Read(p1);
+        reader.Read(p146);
+        for (auto &button : buttons) {
+            reader.Read(button.pressed);
+            reader.Read(button.stuck);
+        }
+        interrupt_source.LoadState(reader);
+        require_frame = true;
+    }
+
     void Keyboard::Tick() {
         if (has_input && interrupt_source.Enabled())
             interrupt_source.TryRaise();
     }
 
-    void Keyboard::Frame() {
+    void Keyboard::PublishFrame() {
         require_frame = false;
 
-        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-        for (auto &button : buttons) {
-            if (button.type != Button::BT_NONE && button.pressed) {
-                if (button.stuck)
-                    SDL_SetRenderDrawColor(renderer, 127, 0, 0, 127);
-                else
-                    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 127);
-                SDL_RenderFillRect(renderer, &button.rect);
+        auto &overlay = overlays.Back();
+        for (size_t ix = 0; ix != overlay.size(); ++ix) {
+            Button &button = buttons[ix];
+            overlay[ix] = !button.pressed ? OV_NONE : button.stuck ? OV_STUCK : OV_PRESSED;
+        }
+        overlays.Publish();
+    }
+
+    void Keyboard::Frame(bool redraw_all) {
+        if (!overlays.Fetch() && !redraw_all)
+            return;
+        const auto &overlay = overlays.Front();
+
+        for (size_t ix = 0; ix != overlay.size(); ++ix) {
+            Button &button = buttons[ix];
+            if (button.type == Button::BT_NONE)
+                continue;
+            if (!redraw_all) {
+                if (overlay[ix] == drawn_overlays[ix])
+                    continue;
+                emulator.RestoreBackground(button.rect);
             }
+            drawn_overlays[ix] = overlay[ix];
+            if (overlay[ix] == OV_NONE)
+                continue;
+
+            SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+            if (overlay[ix] == OV_STUCK)
+                SDL_SetRenderDrawColor(renderer, 127, 0, 0, 127);
+            else
+                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 127);
+            SDL_RenderFillRect(renderer, &button.rect);
         }
     }
 
@@ -228,6 +317,9 @@ namespace casioemu {
 
         require_frame = true;
 
+        if (button.pressed != old_pressed)
+            emulator.events.Emit(EV_KEY, button.code, button.pressed);
+
         if (button.type == Button::BT_POWER && button.pressed && !old_pressed)
             emulator.chipset.Reset();
         if (button.type == Button::BT_BUTTON && button.pressed != old_pressed) {
@@ -247,6 +339,71 @@ namespace casioemu {
         }
     }
 
+    bool Keyboard::LookupKey(const std::string &name, uint8_t &code) {
+        auto name_iter = key_names.find(name);
+        if (name_iter != key_names.end()) {
+            code = name_iter->second;
+            return true;
+        }
+
+        SDL_Keycode keycode = SDL_GetKeyFromName(name.c_str());
+        if (keycode != SDLK_UNKNOWN) {
+            auto map_iter = keyboard_map.find(keycode);
+            if (map_iter != keyboard_map.end()) {
+                code = buttons[map_iter->second].code;
+                return true;
+            }
+        }
+
+        if (name.size() > 1) {
+            char *end;
+            unsigned long value = std::strtoul(name.c_str(), &end, 0);
+            if (!*end && value <= 0xFF) {
+                code = value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Keyboard::LookupKeys(const std::string &sequence, std::vector<uint8_t> &codes, std::string &error) {
+        codes.clear();
+        for (size_t ix = 0; ix != sequence.size();) {
+            size_t begin = ix;
+            size_t end = ix + 1;
+            if (sequence[ix] == '{') {
+                end = sequence.find('}', ix);
+                if (end == std::string::npos) {
+                    error = "unterminated { in key sequence";
+                    return false;
+                }
+                begin = ix + 1;
+            }
+            ix = end + (begin != ix);
+
+            uint8_t code;
+            std::string name = sequence.substr(begin, end - begin);
+            if (!LookupKey(name, code)) {
+                error = "unknown key '" + name + "'";
+                return false;
+            }
+            codes.push_back(code);
+        }
+        return true;
+    }
+
+    bool Keyboard::PressCode(uint8_t code) {
+        Button &button = buttons[code == 0xFF ? 63 : ((code >> 1) & 0x38) | (code & 0x07)];
+        if (button.type == Button::BT_NONE || button.code != code)
+            return false;
+        PressButton(button, false);
+        return true;
+    }
+
+    bool Keyboard::InputPending() {
+        return has_input;
+    }
+
     void Keyboard::PressAt(int x, int y, bool stick) {
         for (auto &button : buttons) {
             if (button.rect.x <= x && button.rect.y <= y && button.rect.x + button.rect.w > x && button.rect.y + button.rect.h > y) {
@@ -337,6 +494,7 @@ namespace casioemu {
         for (auto &button : buttons) {
             if (!button.stuck && button.pressed) {
                 button.pressed = false;
+                emulator.events.Emit(EV_KEY, button.code, 0);
                 if (button.type == Button::BT_BUTTON)
                     had_effect = true;
             }
@@ -3,9 +3,13 @@
 
 #include "../Chipset/InterruptSource.hpp"
 #include "../Chipset/MMURegion.hpp"
+#include "../Data/TripleBuffer.hpp"
 #include "Peripheral.hpp"
 
+#include <array>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace casioemu {
     class Keyboard : public Peripheral {
@@ -29,12 +33,27 @@ namespace casioemu {
                 BT_POWER
             } type;
             SDL_Rect rect;
-            uint8_t ko_bit, ki_bit;
+            uint8_t code, ko_bit, ki_bit;
             bool pressed, stuck;
         } buttons[64];
 
+        /**
+         * What Frame() draws over every button: OV_NONE, OV_PRESSED or
+         * OV_STUCK. PublishFrame() publishes (overlays), (drawn_overlays) is
+         * what Frame() last drew.
+         */
+        enum Overlay : uint8_t {
+            OV_NONE,
+            OV_PRESSED,
+            OV_STUCK
+        };
+        TripleBuffer<std::array<Overlay, 64>> overlays;
+        std::array<Overlay, 64> drawn_overlays;
+
         // Maps from keycode to an index to (buttons).
         std::unordered_map<SDL_Keycode, size_t> keyboard_map;
+        // The optional key_names table of the model, mapping names to button_map codes.
+        std::unordered_map<std::string, uint8_t> key_names;
 
         bool p0, p1, p146;
 
@@ -44,12 +63,37 @@ namespace casioemu {
         void Initialise();
         void Reset();
         void Tick();
-        void Frame();
+        void PublishFrame();
+        void Frame(bool redraw_all);
         void UIEvent(SDL_Event &event);
         void PressButton(Button &button, bool stick);
         void PressAt(int x, int y, bool stick);
         void ReleaseAll();
+        /**
+         * Find the button_map code of a key, given the name of a key in the
+         * model's key_names table, the SDL key name assigned to it in button_map,
+         * or the code itself as a number (e.g. "0x31"). Returns false if there's
+         * no such key.
+         */
+        bool LookupKey(const std::string &name, uint8_t &code);
+        /**
+         * Look up every key of (sequence), in which every character is a key
+         * name, except that {...} encloses a longer one, e.g. "{shift}{F5}1=".
+         * Returns false and describes the problem in (error) if a key is unknown.
+         */
+        bool LookupKeys(const std::string &sequence, std::vector<uint8_t> &codes, std::string &error);
+        /**
+         * Press the button with button_map code (code), as if it were clicked.
+         * Returns false if the model has no such button.
+         */
+        bool PressCode(uint8_t code);
+        /**
+         * True while a pressed button is still visible to the program.
+         */
+        bool InputPending();
         void RecalculateKI();
         void RecalculateGhost();
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
     };
 }
@@ -2,6 +2,7 @@
 
 #include "../Chipset/CPU.hpp"
 #include "../Chipset/Chipset.hpp"
+#include "../Data/StateStream.hpp"
 #include "../Emulator.hpp"
 #include "../Logger.hpp"
 
@@ -39,4 +40,16 @@ namespace casioemu {
         region_F048.Setup(0xF048, 8, "Miscellaneous/Unknown/F048*8", &data_F048, MMURegion::DefaultRead<uint64_t>, MMURegion::DefaultWrite<uint64_t>, emulator);
         region_F220.Setup(0xF220, 4, "Miscellaneous/Unknown/F220*4", &data_F220, MMURegion::DefaultRead<uint32_t>, MMURegion::DefaultWrite<uint32_t>, emulator);
     }
+
+    void Miscellaneous::SaveState(StateWriter &writer) {
+        writer.Write(data);
+        writer.Write(data_F048);
+        writer.Write(data_F220);
+    }
+
+    void Miscellaneous::LoadState(StateReader &reader) {
+        reader.Read(data);
+        reader.Read(data_F048);
+        reader.Read(data_F220);
+    }
 }
@@ -22,5 +22,7 @@ namespace casioemu {
         using Peripheral::Peripheral;
 
         void Initialise();
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
     };
 }
@@ -19,10 +19,13 @@ namespace casioemu {
     void Peripheral::TickAfterInterrupts() {
     }
 
-    void Peripheral::Frame() {
+    void Peripheral::PublishFrame() {
         require_frame = false;
     }
 
+    void Peripheral::Frame(bool) {
+    }
+
     void Peripheral::UIEvent(SDL_Event &) {
     }
 
@@ -32,4 +35,10 @@ namespace casioemu {
     bool Peripheral::GetRequireFrame() {
         return require_frame;
     }
+
+    void Peripheral::SaveState(StateWriter &) {
+    }
+
+    void Peripheral::LoadState(StateReader &) {
+    }
 }
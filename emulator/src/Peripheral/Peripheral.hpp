@@ -5,6 +5,8 @@
 
 namespace casioemu {
     class Emulator;
+    class StateWriter;
+    class StateReader;
 
     class Peripheral {
     protected:
@@ -12,8 +14,8 @@ namespace casioemu {
 
         /**
          * This should be true if the state of this peripheral changed
-         * so that it requires a call to Frame().
-         * It should not directly call Frame() because otherwise it may
+         * so that it requires a call to PublishFrame().
+         * It should not directly call PublishFrame() because otherwise it may
          * call it more than required (once per timer_interval)
          */
         bool require_frame;
@@ -24,10 +26,32 @@ namespace casioemu {
         virtual void Uninitialise();
         virtual void Tick();
         virtual void TickAfterInterrupts();
-        virtual void Frame();
+        /**
+         * Called on the emulation thread, with (access_mx) held, when
+         * (require_frame) is set. Copy whatever Frame() draws into a buffer
+         * that Frame() can read without (access_mx), e.g. a TripleBuffer, and
+         * clear (require_frame).
+         */
+        virtual void PublishFrame();
+        /**
+         * Called on the GUI thread, without (access_mx). Draw what the last
+         * PublishFrame() published onto the frame texture of the emulator,
+         * which keeps what was drawn in earlier calls. If (redraw_all) is true,
+         * the texture has just been filled with the interface background and
+         * everything has to be drawn again. Otherwise only what changed has to
+         * be, after restoring the background under it with
+         * Emulator::RestoreBackground().
+         */
+        virtual void Frame(bool redraw_all);
         virtual void UIEvent(SDL_Event &event);
         virtual void Reset();
         virtual bool GetRequireFrame();
+        /**
+         * Save and restore everything that Reset() and the emulated program can
+         * change. Configuration set up by Initialise() is not included.
+         */
+        virtual void SaveState(StateWriter &writer);
+        virtual void LoadState(StateReader &reader);
         virtual ~Peripheral();
     };
 }
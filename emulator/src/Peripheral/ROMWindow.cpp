@@ -10,9 +10,10 @@
 
 namespace casioemu {
     static void SetupROMRegion(MMURegion &region, size_t region_base, size_t size, size_t rom_base, bool strict_memory, Emulator &emulator, std::string description = {}) {
-        if (rom_base + size > emulator.chipset.rom_data.size())
+        if (rom_base + size > emulator.chipset.rom_size)
             PANIC("Invalid ROM region: base %zx, size %zx\n", rom_base, size);
-        uint8_t *data = emulator.chipset.rom_data.data();
+        // Region userdata is not const, but the write functions below never touch it.
+        uint8_t *data = const_cast<uint8_t *>(emulator.chipset.rom_data);
         if (description.empty())
             description = "ROM/Segment" + std::to_string(region_base >> 16);
 
@@ -20,7 +21,7 @@ namespace casioemu {
         if (strict_memory)
             write_function = [](MMURegion *region, size_t address, uint8_t data) {
                 logger::Info("ROM::[region write lambda]: attempt to write %02hhX to %06zX\n", data, address);
-                region->emulator->HandleMemoryError();
+                region->emulator->HandleMemoryError(address, true);
             };
 
         region.Setup(
@@ -30,6 +31,7 @@ namespace casioemu {
             },
             write_function,
             emulator);
+        region.direct = data + rom_base;
     }
 
     void ROMWindow::Initialise() {
@@ -60,7 +62,7 @@ namespace casioemu {
     void ROMWindow::Tick() {
     }
 
-    void ROMWindow::Frame() {
+    void ROMWindow::Frame(bool) {
     }
 
     void ROMWindow::UIEvent(SDL_Event &) {
@@ -16,7 +16,7 @@ namespace casioemu {
         void Initialise();
         void Uninitialise();
         void Tick();
-        void Frame();
+        void Frame(bool redraw_all);
         void UIEvent(SDL_Event &event);
     };
 }
@@ -6,9 +6,13 @@
 #include "../Data/ColourInfo.hpp"
 #include "../Data/HardwareId.hpp"
 #include "../Data/SpriteInfo.hpp"
+#include "../Data/StateStream.hpp"
+#include "../Data/TripleBuffer.hpp"
 #include "../Emulator.hpp"
 #include "../Logger.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
 namespace casioemu {
@@ -18,7 +22,7 @@ namespace casioemu {
     };
 
     template <HardwareId hardware_id>
-    class Screen : public Peripheral {
+    class Screen : public ScreenBase {
         static int const N_ROW, // excluding the 1 row used for status line
             ROW_SIZE,           // bytes
             OFFSET,             // bytes
@@ -30,12 +34,47 @@ namespace casioemu {
         SDL_Renderer *renderer;
         SDL_Texture *interface_texture;
 
+        /**
+         * The dot matrix at one texel per dot, scaled to the rsd_pixel geometry
+         * when drawn. (dot_pixels) keeps a copy of its texels, so that only rows
+         * that changed need to be expanded and uploaded. (dot_lut) maps a byte of
+         * the screen buffer to its eight texels for the current ink colour and
+         * contrast.
+         */
+        SDL_Texture *dot_texture;
+        std::vector<uint32_t> dot_pixels;
+        uint32_t dot_lut[256][8];
+        int dot_lut_alpha_on, dot_lut_alpha_off;
+        bool dot_lut_cleared;
+        /**
+         * Returns true if the table changed, in which case every row has to be
+         * expanded again.
+         */
+        bool UpdateDotLUT(int alpha_on, int alpha_off, bool cleared);
+
+        /**
+         * What Frame() draws, as published by PublishFrame().
+         */
+        struct FrameData {
+            std::vector<uint8_t> buffer;
+            uint8_t contrast, mode;
+        };
+        TripleBuffer<FrameData> frames;
+        /**
+         * The screen buffer as last expanded into (dot_texture). Frame() may
+         * skip publications, so the rows to expand are found by comparing
+         * against this.
+         */
+        std::vector<uint8_t> drawn_buffer;
+
         enum Sprite : unsigned {
         };
 
         static const SpriteBitmap sprite_bitmap[];
         std::vector<SpriteInfo> sprite_info;
         ColourInfo ink_colour;
+        // Covers the status icons and the dot matrix.
+        SDL_Rect lcd_rect;
 
         /**
          * Similar to MMURegion::DefaultRead, but takes the pointer to the Screen
@@ -78,14 +117,24 @@ namespace casioemu {
             if (only_on_change && old_value == value)
                 return;
             this_obj->require_frame = true;
+            ++this_obj->version;
         }
 
     public:
-        using Peripheral::Peripheral;
+        using ScreenBase::ScreenBase;
 
         void Initialise();
         void Uninitialise();
-        void Frame();
+        void PublishFrame();
+        void Frame(bool redraw_all);
+        const uint8_t *GetBuffer();
+        size_t GetBufferSize();
+        int GetWidth();
+        int GetHeight();
+        void ReadDots(std::vector<uint8_t> &dots);
+        void ReadStatus(std::vector<const char *> &icons);
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
     };
 
     template <>
@@ -219,9 +268,27 @@ namespace casioemu {
         for (int ix = 0; ix != SPR_MAX; ++ix)
             sprite_info[ix] = emulator.GetModelInfo(sprite_bitmap[ix].name);
 
+        const SpriteInfo &pixel = sprite_info[Sprite::SPR_PIXEL];
+        lcd_rect = {pixel.dest.x, pixel.dest.y, ROW_SIZE_DISP * 8 * pixel.src.w, N_ROW * pixel.src.h};
+        for (int ix = Sprite::SPR_PIXEL + 1; ix != SPR_MAX; ++ix)
+            SDL_UnionRect(&lcd_rect, &sprite_info[ix].dest, &lcd_rect);
+
         ink_colour = emulator.GetModelInfo("ink_colour");
         require_frame = true;
 
+        dot_texture = nullptr;
+        dot_lut_alpha_on = dot_lut_alpha_off = -1;
+        dot_lut_cleared = false;
+        drawn_buffer.clear();
+        if (renderer) {
+            dot_pixels.resize(N_ROW * ROW_SIZE_DISP * 8);
+            dot_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, ROW_SIZE_DISP * 8, N_ROW);
+            if (!dot_texture)
+                PANIC("SDL_CreateTexture failed: %s\n", SDL_GetError());
+            SDL_SetTextureBlendMode(dot_texture, SDL_BLENDMODE_BLEND);
+            SDL_SetTextureScaleMode(dot_texture, SDL_ScaleModeNearest);
+        }
+
         screen_buffer = new uint8_t[(N_ROW + 1) * ROW_SIZE];
 
         region_buffer.Setup(
@@ -238,7 +305,10 @@ namespace casioemu {
                     return;
                 auto this_obj = (Screen *)region->userdata;
                 // * Set require_frame to true only if the value changed.
-                this_obj->require_frame |= this_obj->screen_buffer[offset] != data;
+                if (this_obj->screen_buffer[offset] == data)
+                    return;
+                this_obj->require_frame = true;
+                ++this_obj->version;
                 this_obj->screen_buffer[offset] = data;
             },
             emulator);
@@ -255,23 +325,65 @@ namespace casioemu {
 
     template <HardwareId hardware_id>
     void Screen<hardware_id>::Uninitialise() {
+        if (dot_texture)
+            SDL_DestroyTexture(dot_texture);
         delete[] screen_buffer;
     }
 
     template <HardwareId hardware_id>
-    void Screen<hardware_id>::Frame() {
+    bool Screen<hardware_id>::UpdateDotLUT(int alpha_on, int alpha_off, bool cleared) {
+        if (alpha_on == dot_lut_alpha_on && alpha_off == dot_lut_alpha_off && cleared == dot_lut_cleared)
+            return false;
+        dot_lut_alpha_on = alpha_on;
+        dot_lut_alpha_off = alpha_off;
+        dot_lut_cleared = cleared;
+
+        // With (cleared), every byte expands to unlit dots.
+        uint32_t colour = (uint32_t)ink_colour.r << 16 | (uint32_t)ink_colour.g << 8 | ink_colour.b;
+        uint32_t on = (uint32_t)alpha_on << 24 | colour;
+        uint32_t off = (uint32_t)alpha_off << 24 | colour;
+        for (int byte = 0; byte != 256; ++byte)
+            for (int ix = 0; ix != 8; ++ix)
+                dot_lut[byte][ix] = !cleared && byte & (0x80 >> ix) ? on : off;
+        return true;
+    }
+
+    template <HardwareId hardware_id>
+    void Screen<hardware_id>::PublishFrame() {
         require_frame = false;
+        if (!renderer)
+            return;
+
+        FrameData &frame = frames.Back();
+        frame.buffer.assign(screen_buffer, screen_buffer + (N_ROW + 1) * ROW_SIZE);
+        frame.contrast = screen_contrast;
+        frame.mode = screen_mode;
+        frames.Publish();
+    }
 
-        int ink_alpha_on = 20 + screen_contrast * 16;
+    template <HardwareId hardware_id>
+    void Screen<hardware_id>::Frame(bool redraw_all) {
+        if (!frames.Fetch() && !redraw_all)
+            return;
+        const FrameData &frame = frames.Front();
+        // Nothing has been published yet.
+        if (frame.buffer.empty())
+            return;
+
+        // The icons and the dots are blended over the background, so it has to go under them first.
+        if (!redraw_all)
+            emulator.RestoreBackground(lcd_rect);
+
+        int ink_alpha_on = 20 + frame.contrast * 16;
         if (ink_alpha_on > 255)
             ink_alpha_on = 255;
-        int ink_alpha_off = (screen_contrast - 8) * 7;
+        int ink_alpha_off = (frame.contrast - 8) * 7;
         if (ink_alpha_off < 0)
             ink_alpha_off = 0;
 
         bool enable_status, enable_dotmatrix, clear_dots;
 
-        switch (screen_mode) {
+        switch (frame.mode) {
         case 4:
             enable_dotmatrix = true;
             clear_dots = true;
@@ -300,7 +412,7 @@ namespace casioemu {
 
         if (enable_status) {
             for (int ix = Sprite::SPR_PIXEL + 1; ix != Sprite::SPR_MAX; ++ix) {
-                if (screen_buffer[sprite_bitmap[ix].offset] & sprite_bitmap[ix].mask)
+                if (frame.buffer[sprite_bitmap[ix].offset] & sprite_bitmap[ix].mask)
                     SDL_SetTextureAlphaMod(interface_texture, ink_alpha_on);
                 else
                     SDL_SetTextureAlphaMod(interface_texture, ink_alpha_off);
@@ -309,25 +421,94 @@ namespace casioemu {
         }
 
         if (enable_dotmatrix) {
-            static constexpr auto SPR_PIXEL = Sprite::SPR_PIXEL;
-            SDL_Rect dest = Screen<hardware_id>::sprite_info[SPR_PIXEL].dest;
+            bool all_rows = UpdateDotLUT(ink_alpha_on, ink_alpha_off, clear_dots) || drawn_buffer.empty();
+
+            // Only the rows that changed are expanded, and the span between the first and
+            // the last of them is uploaded in one go.
+            const int width = ROW_SIZE_DISP * 8;
+            int first = N_ROW, last = -1;
             for (int iy = 0; iy != N_ROW; ++iy) {
-                dest.x = sprite_info[SPR_PIXEL].dest.x;
-                dest.y = sprite_info[SPR_PIXEL].dest.y + iy * sprite_info[SPR_PIXEL].src.h;
-                for (int ix = 0; ix != ROW_SIZE_DISP; ++ix) {
-                    for (uint8_t mask = 0x80; mask; mask >>= 1, dest.x += sprite_info[SPR_PIXEL].src.w) {
-                        if (!clear_dots && screen_buffer[iy * ROW_SIZE + OFFSET + ix] & mask)
-                            SDL_SetTextureAlphaMod(interface_texture, ink_alpha_on);
-                        else
-                            SDL_SetTextureAlphaMod(interface_texture, ink_alpha_off);
-                        SDL_RenderCopy(renderer, interface_texture, &sprite_info[SPR_PIXEL].src, &dest);
-                    }
-                }
+                const uint8_t *dots = &frame.buffer[iy * ROW_SIZE + OFFSET];
+                if (!all_rows && !std::memcmp(dots, &drawn_buffer[iy * ROW_SIZE + OFFSET], ROW_SIZE_DISP))
+                    continue;
+                uint32_t *row = &dot_pixels[iy * width];
+                for (int ix = 0; ix != ROW_SIZE_DISP; ++ix)
+                    std::memcpy(row + ix * 8, dot_lut[dots[ix]], sizeof(dot_lut[0]));
+                first = std::min(first, iy);
+                last = iy;
+            }
+            if (last >= 0) {
+                SDL_Rect rows = {0, first, width, last - first + 1};
+                SDL_UpdateTexture(dot_texture, &rows, &dot_pixels[first * width], width * sizeof(uint32_t));
             }
+            drawn_buffer = frame.buffer;
+
+            const SpriteInfo &pixel = sprite_info[Sprite::SPR_PIXEL];
+            SDL_Rect dest = {pixel.dest.x, pixel.dest.y, ROW_SIZE_DISP * 8 * pixel.src.w, N_ROW * pixel.src.h};
+            SDL_RenderCopy(renderer, dot_texture, nullptr, &dest);
         }
     }
 
-    Peripheral *CreateScreen(Emulator &emulator) {
+    template <HardwareId hardware_id>
+    const uint8_t *Screen<hardware_id>::GetBuffer() {
+        return screen_buffer;
+    }
+
+    template <HardwareId hardware_id>
+    size_t Screen<hardware_id>::GetBufferSize() {
+        return (N_ROW + 1) * ROW_SIZE;
+    }
+
+    template <HardwareId hardware_id>
+    int Screen<hardware_id>::GetWidth() {
+        return ROW_SIZE_DISP * 8;
+    }
+
+    template <HardwareId hardware_id>
+    int Screen<hardware_id>::GetHeight() {
+        return N_ROW;
+    }
+
+    template <HardwareId hardware_id>
+    void Screen<hardware_id>::ReadDots(std::vector<uint8_t> &dots) {
+        dots.assign(N_ROW * ROW_SIZE_DISP, 0);
+        // Same as in Frame(): only mode 5 shows the content of the buffer.
+        if (screen_mode != 5)
+            return;
+        for (int iy = 0; iy != N_ROW; ++iy)
+            std::copy(screen_buffer + (iy * ROW_SIZE + OFFSET), screen_buffer + (iy * ROW_SIZE + OFFSET + ROW_SIZE_DISP),
+                      dots.begin() + iy * ROW_SIZE_DISP);
+    }
+
+    template <HardwareId hardware_id>
+    void Screen<hardware_id>::ReadStatus(std::vector<const char *> &icons) {
+        icons.clear();
+        if (screen_mode != 5 && screen_mode != 6)
+            return;
+        for (int ix = Sprite::SPR_PIXEL + 1; ix != Sprite::SPR_MAX; ++ix)
+            if (screen_buffer[sprite_bitmap[ix].offset] & sprite_bitmap[ix].mask)
+                icons.push_back(sprite_bitmap[ix].name + 4); // without "rsd_"
+    }
+
+    template <HardwareId hardware_id>
+    void Screen<hardware_id>::SaveState(StateWriter &writer) {
+        writer.WriteBytes(screen_buffer, (N_ROW + 1) * ROW_SIZE);
+        writer.Write(screen_contrast);
+        writer.Write(screen_mode);
+        writer.Write(screen_range);
+    }
+
+    template <HardwareId hardware_id>
+    void Screen<hardware_id>::LoadState(StateReader &reader) {
+        reader.ReadBytes(screen_buffer, (N_ROW + 1) * ROW_SIZE);
+        reader.Read(screen_contrast);
+        reader.Read(screen_mode);
+        reader.Read(screen_range);
+        require_frame = true;
+        ++version;
+    }
+
+    ScreenBase *CreateScreen(Emulator &emulator) {
         switch (emulator.hardware_id) {
         case HW_ES_PLUS:
             return new Screen<HW_ES_PLUS>(emulator);
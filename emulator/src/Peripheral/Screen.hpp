@@ -3,6 +3,60 @@
 
 #include "Peripheral.hpp"
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
 namespace casioemu {
-    Peripheral *CreateScreen(Emulator &emulator);
+    /**
+     * The part of the screen peripheral that does not depend on the hardware id.
+     * Code outside of the renderer should only access the screen through this.
+     */
+    class ScreenBase : public Peripheral {
+    protected:
+        /**
+         * Incremented whenever the buffer or a display register changes value.
+         */
+        uint64_t version = 0;
+
+    public:
+        using Peripheral::Peripheral;
+
+        uint64_t GetVersion() {
+            return version;
+        }
+
+        /**
+         * Only used by run-ahead, to take back the changes counted during
+         * emulation that was rolled back.
+         */
+        void SetVersion(uint64_t _version) {
+            version = _version;
+        }
+
+        /**
+         * The raw screen buffer as mapped at 0xF800. The first row holds the
+         * status icons, the dot matrix follows.
+         */
+        virtual const uint8_t *GetBuffer() = 0;
+        virtual size_t GetBufferSize() = 0;
+
+        /**
+         * Size of the dot matrix in pixels. (width) is always a multiple of 8.
+         */
+        virtual int GetWidth() = 0;
+        virtual int GetHeight() = 0;
+        /**
+         * What the dot matrix currently shows, packed 1 bit per pixel: GetHeight()
+         * rows of GetWidth() / 8 bytes, the leftmost pixel in the most significant
+         * bit. All dots are clear while the display is off or blanked.
+         */
+        virtual void ReadDots(std::vector<uint8_t> &dots) = 0;
+        /**
+         * Names of the status icons that are currently lit ("s", "math", ...).
+         */
+        virtual void ReadStatus(std::vector<const char *> &icons) = 0;
+    };
+
+    ScreenBase *CreateScreen(Emulator &emulator);
 }
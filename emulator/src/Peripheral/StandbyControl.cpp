@@ -2,6 +2,7 @@
 
 #include "../Chipset/Chipset.hpp"
 #include "../Chipset/MMU.hpp"
+#include "../Data/StateStream.hpp"
 #include "../Emulator.hpp"
 #include "../Logger.hpp"
 
@@ -37,4 +38,14 @@ namespace casioemu {
         stpacp_last = 0;
         stop_acceptor_enabled = false;
     }
+
+    void StandbyControl::SaveState(StateWriter &writer) {
+        writer.Write(stpacp_last);
+        writer.Write(stop_acceptor_enabled);
+    }
+
+    void StandbyControl::LoadState(StateReader &reader) {
+        reader.Read(stpacp_last);
+        reader.Read(stop_acceptor_enabled);
+    }
 }
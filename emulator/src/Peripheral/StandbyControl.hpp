@@ -15,5 +15,7 @@ namespace casioemu {
 
         void Initialise();
         void Reset();
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
     };
 }
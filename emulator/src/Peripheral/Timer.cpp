@@ -2,6 +2,7 @@
 
 #include "../Chipset/Chipset.hpp"
 #include "../Chipset/MMU.hpp"
+#include "../Data/StateStream.hpp"
 #include "../Emulator.hpp"
 #include "../Logger.hpp"
 
@@ -51,6 +52,30 @@ namespace casioemu {
         data_control = 0;
     }
 
+    void Timer::SaveState(StateWriter &writer) {
+        writer.Write(data_counter);
+        writer.Write(data_interval);
+        writer.Write(data_F024);
+        writer.Write(data_control);
+        writer.Write(raise_required);
+        writer.Write(ext_to_int_counter);
+        writer.Write(ext_to_int_next);
+        writer.Write(ext_to_int_int_done);
+        interrupt_source.SaveState(writer);
+    }
+
+    void Timer::LoadState(StateReader &reader) {
+        reader.Read(data_counter);
+        reader.Read(data_interval);
+        reader.Read(data_F024);
+        reader.Read(data_control);
+        reader.Read(raise_required);
+        reader.Read(ext_to_int_counter);
+        reader.Read(ext_to_int_next);
+        reader.Read(ext_to_int_int_done);
+        interrupt_source.LoadState(reader);
+    }
+
     void Timer::Tick() {
         if (ext_to_int_counter == ext_to_int_next)
             DivideTicks();
@@ -25,5 +25,7 @@ namespace casioemu {
         void Tick();
         void TickAfterInterrupts();
         void DivideTicks();
+        void SaveState(StateWriter &writer);
+        void LoadState(StateReader &reader);
     };
 }
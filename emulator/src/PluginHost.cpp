@@ -0,0 +1,172 @@
+#include "PluginHost.hpp"
+
+#include "Chipset/CPU.hpp"
+#include "Chipset/Chipset.hpp"
+#include "Chipset/MMU.hpp"
+#include "Emulator.hpp"
+#include "Logger.hpp"
+#include "Peripheral/BatteryBackedRAM.hpp"
+#include "Peripheral/Screen.hpp"
+
+#include <SDL.h>
+
+namespace casioemu {
+    static_assert(CASIOEMU_EVENT_HALT == (int)EV_HALT && CASIOEMU_EVENT_INTERRUPT == (int)EV_INTERRUPT &&
+                      CASIOEMU_EVENT_FRAME == (int)EV_FRAME && CASIOEMU_EVENT_KEY == (int)EV_KEY &&
+                      CASIOEMU_EVENT_MEM_ERROR == (int)EV_MEM_ERROR && CASIOEMU_EVENT_COUNT == (int)EV_COUNT,
+                  "plugin event numbers must match EventType");
+
+    PluginHost::PluginHost(Emulator &_emulator) : emulator(_emulator) {
+        CPU &chipset_cpu = emulator.chipset.cpu;
+        for (size_t ix = 0; ix != 16; ++ix)
+            cpu.r[ix] = &chipset_cpu.reg_r[ix].raw;
+        cpu.pc = &chipset_cpu.reg_pc.raw;
+        cpu.csr = &chipset_cpu.reg_csr.raw;
+        cpu.sp = &chipset_cpu.reg_sp.raw;
+        cpu.ea = &chipset_cpu.reg_ea.raw;
+        cpu.psw = &chipset_cpu.reg_psw.raw;
+        cpu.dsr = &chipset_cpu.reg_dsr.raw;
+        cpu.lr = &chipset_cpu.reg_lr.raw;
+        cpu.lcsr = &chipset_cpu.reg_lcsr.raw;
+
+        BatteryBackedRAM &ram = *emulator.chipset.battery_backed_ram;
+        host.abi_version = CASIOEMU_PLUGIN_ABI_VERSION;
+        host.hardware_id = emulator.hardware_id;
+        host.cpu = &cpu;
+        host.ram = ram.ram_buffer;
+        host.ram_base = ram.GetBase();
+        host.ram_size = ram.GetSize();
+        host.context = this;
+        host.add_instruction_hook = AddInstructionHook;
+        host.add_memory_watch = AddMemoryWatch;
+        host.add_region = AddRegion;
+        host.add_frame_hook = AddFrameHook;
+        host.get_option = GetOption;
+        host.log = Log;
+        host.subscribe = Subscribe;
+
+        auto plugin_iter = emulator.argv_map.find("plugin");
+        if (plugin_iter == emulator.argv_map.end())
+            return;
+        const std::string &paths = plugin_iter->second;
+        for (size_t begin = 0, end; begin < paths.size(); begin = end + 1) {
+            end = paths.find(';', begin);
+            if (end == std::string::npos)
+                end = paths.size();
+            if (end != begin)
+                Load(paths.substr(begin, end - begin));
+        }
+    }
+
+    PluginHost::~PluginHost() {
+        for (auto it = plugins.rbegin(); it != plugins.rend(); ++it) {
+            if (it->exit)
+                it->exit(&host);
+            SDL_UnloadObject(it->object);
+        }
+
+        if (!frame_hooks.empty())
+            emulator.events.Unsubscribe(EV_FRAME, FrameHandler, this);
+        for (auto &subscriber : event_subscribers)
+            emulator.events.Unsubscribe(subscriber->type, EventHandler, subscriber.get());
+    }
+
+    void PluginHost::Load(const std::string &path) {
+        Plugin plugin;
+        plugin.path = path;
+        plugin.object = SDL_LoadObject(path.c_str());
+        if (!plugin.object)
+            PANIC("failed to load plugin %s: %s\n", path.c_str(), SDL_GetError());
+
+        auto init = (casioemu_plugin_init_fn)SDL_LoadFunction(plugin.object, CASIOEMU_PLUGIN_INIT);
+        if (!init)
+            PANIC("plugin %s does not export %s\n", path.c_str(), CASIOEMU_PLUGIN_INIT);
+        plugin.exit = (casioemu_plugin_exit_fn)SDL_LoadFunction(plugin.object, CASIOEMU_PLUGIN_EXIT);
+
+        // Registered first, so that the exit function runs even if init fails halfway.
+        plugins.push_back(plugin);
+        if (int result = init(&host))
+            PANIC("plugin %s failed to initialise (%d)\n", path.c_str(), result);
+        logger::Info("loaded plugin %s\n", path.c_str());
+    }
+
+    void PluginHost::FrameHandler(void *userdata, EventType, uint32_t, uint32_t) {
+        PluginHost *self = (PluginHost *)userdata;
+        ScreenBase &screen = *self->emulator.chipset.screen;
+        for (auto &hook : self->frame_hooks)
+            hook.fn(hook.user, screen.GetBuffer(), screen.GetBufferSize());
+    }
+
+    void PluginHost::EventHandler(void *userdata, EventType type, uint32_t arg0, uint32_t arg1) {
+        EventSubscriber *subscriber = (EventSubscriber *)userdata;
+        subscriber->fn(subscriber->user, type, arg0, arg1);
+    }
+
+    int PluginHost::AddInstructionHook(casioemu_host *host, casioemu_instruction_fn fn, void *user) {
+        PluginHost *self = (PluginHost *)host->context;
+        if (!fn)
+            return -1;
+        self->emulator.chipset.cpu.AddNativeInstructionHook(fn, user);
+        return 0;
+    }
+
+    int PluginHost::AddMemoryWatch(casioemu_host *host, uint32_t begin, uint32_t end, casioemu_memory_fn on_read, casioemu_memory_fn on_write, void *user) {
+        PluginHost *self = (PluginHost *)host->context;
+        if (begin >= end || end > (1 << 24) || (!on_read && !on_write))
+            return -1;
+        self->emulator.chipset.mmu.AddNativeWatch(begin, end, on_read, on_write, user);
+        return 0;
+    }
+
+    int PluginHost::AddRegion(casioemu_host *host, uint32_t base, uint32_t size, const char *name, casioemu_region_read_fn read, casioemu_region_write_fn write, void *user) {
+        PluginHost *self = (PluginHost *)host->context;
+        if (!size || base >= (1 << 24) || size > (1 << 24) - base || !read || !write)
+            return -1;
+
+        Region *region = new Region;
+        region->read = read;
+        region->write = write;
+        region->user = user;
+        self->regions.emplace_back(region);
+        region->region.Setup(base, size, std::string("Plugin/") + (name ? name : "?"), region, [](MMURegion *region, size_t offset) {
+            Region *plugin_region = (Region *)region->userdata;
+            return plugin_region->read(plugin_region->user, offset);
+        }, [](MMURegion *region, size_t offset, uint8_t data) {
+            Region *plugin_region = (Region *)region->userdata;
+            plugin_region->write(plugin_region->user, offset, data);
+        }, self->emulator);
+        return 0;
+    }
+
+    int PluginHost::AddFrameHook(casioemu_host *host, casioemu_frame_fn fn, void *user) {
+        PluginHost *self = (PluginHost *)host->context;
+        if (!fn)
+            return -1;
+        if (self->frame_hooks.empty())
+            self->emulator.events.Subscribe(EV_FRAME, FrameHandler, self);
+        self->frame_hooks.push_back({fn, user});
+        return 0;
+    }
+
+    int PluginHost::Subscribe(casioemu_host *host, int event, casioemu_event_fn fn, void *user) {
+        PluginHost *self = (PluginHost *)host->context;
+        if (event < 0 || event >= EV_COUNT || !fn)
+            return -1;
+        EventSubscriber *subscriber = new EventSubscriber{(EventType)event, fn, user};
+        self->event_subscribers.emplace_back(subscriber);
+        self->emulator.events.Subscribe(subscriber->type, EventHandler, subscriber);
+        return 0;
+    }
+
+    const char *PluginHost::GetOption(casioemu_host *host, const char *key) {
+        PluginHost *self = (PluginHost *)host->context;
+        auto it = self->emulator.argv_map.find(key);
+        if (it == self->emulator.argv_map.end())
+            return nullptr;
+        return it->second.c_str();
+    }
+
+    void PluginHost::Log(casioemu_host *, const char *message) {
+        logger::Info("%s", message);
+    }
+} // namespace casioemu
@@ -0,0 +1,75 @@
+#pragma once
+#include "Config.hpp"
+
+#include "Chipset/MMURegion.hpp"
+#include "EventBus.hpp"
+#include "casioemu_plugin.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace casioemu {
+    class Emulator;
+
+    /**
+     * Loads the native plugins named by the `plugin` key (a ';' separated list
+     * of paths) and implements the host side of casioemu_plugin.h for them.
+     * Instruction hooks and memory watches are handed to the CPU and the MMU,
+     * which call them directly.
+     */
+    class PluginHost {
+        Emulator &emulator;
+
+        struct Plugin {
+            std::string path;
+            void *object;
+            casioemu_plugin_exit_fn exit;
+        };
+        std::vector<Plugin> plugins;
+
+        struct Region {
+            MMURegion region;
+            casioemu_region_read_fn read;
+            casioemu_region_write_fn write;
+            void *user;
+        };
+        std::vector<std::unique_ptr<Region>> regions;
+
+        struct FrameHook {
+            casioemu_frame_fn fn;
+            void *user;
+        };
+        std::vector<FrameHook> frame_hooks;
+        static void FrameHandler(void *userdata, EventType type, uint32_t arg0, uint32_t arg1);
+
+        struct EventSubscriber {
+            EventType type;
+            casioemu_event_fn fn;
+            void *user;
+        };
+        std::vector<std::unique_ptr<EventSubscriber>> event_subscribers;
+        static void EventHandler(void *userdata, EventType type, uint32_t arg0, uint32_t arg1);
+
+        casioemu_cpu cpu;
+        casioemu_host host;
+
+        static int AddInstructionHook(casioemu_host *host, casioemu_instruction_fn fn, void *user);
+        static int AddMemoryWatch(casioemu_host *host, uint32_t begin, uint32_t end, casioemu_memory_fn on_read, casioemu_memory_fn on_write, void *user);
+        static int AddRegion(casioemu_host *host, uint32_t base, uint32_t size, const char *name, casioemu_region_read_fn read, casioemu_region_write_fn write, void *user);
+        static int AddFrameHook(casioemu_host *host, casioemu_frame_fn fn, void *user);
+        static const char *GetOption(casioemu_host *host, const char *key);
+        static void Log(casioemu_host *host, const char *message);
+        static int Subscribe(casioemu_host *host, int event, casioemu_event_fn fn, void *user);
+
+    public:
+        /**
+         * Must be constructed after the chipset is set up, since plugins get
+         * pointers into it.
+         */
+        PluginHost(Emulator &emulator);
+        ~PluginHost();
+        void Load(const std::string &path);
+    };
+} // namespace casioemu
@@ -5,6 +5,7 @@
 #include <SDL.h>
 #include <SDL_image.h>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <iostream>
@@ -15,8 +16,12 @@
 #include <string>
 #include <thread>
 
+#include "BatchServer.hpp"
+#include "Data/ArgvNumber.hpp"
 #include "Data/EventCode.hpp"
 #include "Emulator.hpp"
+#include "EmulatorPool.hpp"
+#include "LCDCapture.hpp"
 #include "Logger.hpp"
 #include "SDL_events.h"
 #include "SDL_keyboard.h"
@@ -51,12 +56,32 @@ int main(int argc, char *argv[]) {
             logger::Info("[argv] #%i: key '%s' already set\n", ix, key.c_str());
     }
 
+    auto convert_capture_iter = argv_map.find("convert_capture");
+    if (convert_capture_iter != argv_map.end()) {
+        // Offline conversion of a capture stream, no emulator involved.
+        auto out_iter = argv_map.find("out");
+        if (out_iter == argv_map.end()) {
+            printf("No output path supplied\n");
+            exit(2);
+        }
+        int scale = 3;
+        auto scale_iter = argv_map.find("scale");
+        if (scale_iter != argv_map.end())
+            scale = ParseArgvNumber("scale", scale_iter->second, 1, 65535);
+        std::string error;
+        if (!LCDCapture::ConvertToGIF(convert_capture_iter->second, out_iter->second, scale, error))
+            PANIC("%s\n", error.c_str());
+        return 0;
+    }
+
     if (argv_map.find("model") == argv_map.end()) {
         printf("No model path supplied\n");
         exit(2);
     }
 
-    int sdlFlags = SDL_INIT_VIDEO | SDL_INIT_TIMER;
+    bool headless = argv_map.find("headless") != argv_map.end();
+
+    int sdlFlags = headless ? SDL_INIT_TIMER : SDL_INIT_VIDEO | SDL_INIT_TIMER;
     if (SDL_Init(sdlFlags) != 0)
         PANIC("SDL_Init failed: %s\n", SDL_GetError());
 
@@ -64,6 +89,27 @@ int main(int argc, char *argv[]) {
     if (IMG_Init(imgFlags) != imgFlags)
         PANIC("IMG_Init failed: %s\n", IMG_GetError());
 
+    if (headless) {
+        // Batch mode: the startup script of each instance drives it, and the process exits once all scripts return.
+        size_t instances = 1;
+        auto instances_iter = argv_map.find("instances");
+        if (instances_iter != argv_map.end())
+            instances = ParseArgvNumber("instances", instances_iter->second, 1, 1024);
+
+        if (argv_map.find("serve") != argv_map.end()) {
+            // Server mode: evaluate requests from stdin until it's closed.
+            BatchServer server(argv_map, instances);
+            server.Run();
+        } else {
+            EmulatorPool pool(argv_map, instances);
+            pool.Wait();
+        }
+
+        IMG_Quit();
+        SDL_Quit();
+        return 0;
+    }
+
     std::string history_filename;
     auto history_filename_iter = argv_map.find("history");
     if (history_filename_iter != argv_map.end())
@@ -77,14 +123,13 @@ int main(int argc, char *argv[]) {
 
     {
         Emulator emulator(argv_map);
-        m_emu = &emulator;
 
         // Note: argv_map must be destructed after emulator.
 
         // Used to signal to the console input thread when to stop.
         static std::atomic<bool> running(true);
 
-        init_debugger_window();
+        init_debugger_window(emulator);
         std::thread console_input_thread([&] {
             struct terminate_thread {};
             rl_event_hook = []() {
@@ -145,16 +190,24 @@ int main(int argc, char *argv[]) {
                 }
             }
         });
-        std::thread t1([&]() {
-            while (1) {
+        std::thread debugger_thread([&]() {
+            // ImGui may need a couple more frames to settle after input, e.g. to highlight a hovered item.
+            int extra_frames = 0;
+            while (emulator.Running()) {
+                if (emulator.WaitDebugger(std::chrono::milliseconds(extra_frames ? 16 : 200)))
+                    extra_frames = 2;
+                else if (extra_frames)
+                    --extra_frames;
+                else
+                    continue;
                 debugger_gui_loop();
             }
         });
-        t1.detach();
 
         while (emulator.Running()) {
+            // Frame requests and console commands arrive as events too, the timeout only catches shutdowns that don't.
             SDL_Event event;
-            if (!SDL_PollEvent(&event))
+            if (!SDL_WaitEventTimeout(&event, 100))
                 continue;
 
             switch (event.type) {
@@ -171,6 +224,12 @@ int main(int argc, char *argv[]) {
                 break;
 
             case SDL_WINDOWEVENT:
+                if (event.window.event != SDL_WINDOWEVENT_CLOSE && event.window.windowID != SDL_GetWindowID(emulator.window)) {
+                    // The debugger window was resized, exposed, focused...
+                    ImGui_ImplSDL2_ProcessEvent(&event);
+                    emulator.WakeDebugger();
+                    break;
+                }
                 switch (event.window.event) {
                 case SDL_WINDOWEVENT_CLOSE:
                     emulator.Shutdown();
@@ -186,6 +245,14 @@ int main(int argc, char *argv[]) {
                 }
                 break;
 
+            case SDL_RENDER_TARGETS_RESET: {
+                // The frame texture lost its content, draw it again at the current size.
+                int window_width, window_height;
+                SDL_GetWindowSize(emulator.window, &window_width, &window_height);
+                emulator.WindowResize(window_width, window_height);
+                break;
+            }
+
             case SDL_MOUSEBUTTONDOWN:
             case SDL_MOUSEBUTTONUP:
             case SDL_KEYDOWN:
@@ -195,6 +262,7 @@ int main(int argc, char *argv[]) {
             case SDL_MOUSEWHEEL:
                 if (SDL_GetKeyboardFocus() != emulator.window || SDL_GetMouseFocus() != emulator.window) {
                     ImGui_ImplSDL2_ProcessEvent(&event);
+                    emulator.WakeDebugger();
                     break;
                 }
                 emulator.UIEvent(event);
@@ -204,6 +272,7 @@ int main(int argc, char *argv[]) {
 
         running = false;
         console_input_thread.join();
+        debugger_thread.join();
     }
 
     std::cout << std::endl;
@@ -0,0 +1,144 @@
+/**
+ * The C interface between the emulator and native plugins.
+ *
+ * A plugin is a shared library (a DLL on Windows) named on the command line
+ * with the `plugin` key. It exports casioemu_plugin_init and, optionally,
+ * casioemu_plugin_exit. Both are called once for every emulator that loads the
+ * plugin, so a plugin that keeps state should keep it per (host).
+ *
+ * All callbacks are called on the emulation thread while the emulator is
+ * locked, so they may freely read and write the CPU registers and RAM through
+ * the pointers in casioemu_host, and must not block.
+ *
+ * The interface only ever grows: new fields are appended to casioemu_host and
+ * CASIOEMU_PLUGIN_ABI_VERSION is bumped. A plugin built against an older
+ * header keeps working; a plugin that needs newer fields should check
+ * (abi_version) first.
+ */
+#ifndef CASIOEMU_PLUGIN_H
+#define CASIOEMU_PLUGIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CASIOEMU_PLUGIN_ABI_VERSION 2
+
+#ifdef _WIN32
+#define CASIOEMU_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define CASIOEMU_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+typedef struct casioemu_host casioemu_host;
+
+/**
+ * Pointers to the CPU registers. Every register is stored in a uint16_t;
+ * 8-bit registers only use the low byte and must be written with the high
+ * byte clear. The PC of an instruction is (*csr << 16 | *pc).
+ */
+typedef struct casioemu_cpu {
+    uint16_t *r[16];
+    uint16_t *pc, *csr, *sp, *ea, *psw, *dsr;
+    uint16_t *lr, *lcsr;
+} casioemu_cpu;
+
+/**
+ * Called before every instruction with the address of that instruction. A DSR
+ * prefix counts as part of the instruction it prefixes.
+ */
+typedef void (*casioemu_instruction_fn)(void *user, uint32_t real_pc);
+/**
+ * Called when the program reads (value) from (offset) as data, or is about
+ * to write (value) to it.
+ */
+typedef void (*casioemu_memory_fn)(void *user, uint32_t offset, uint8_t value);
+/**
+ * Handlers of a memory region added by a plugin. (offset) is the absolute
+ * address, not relative to the start of the region.
+ */
+typedef uint8_t (*casioemu_region_read_fn)(void *user, uint32_t offset);
+typedef void (*casioemu_region_write_fn)(void *user, uint32_t offset, uint8_t value);
+/**
+ * Called at the end of every emulated frame (20 ms of emulated time) in which
+ * the screen changed. (screen) is the raw screen buffer of the chipset.
+ */
+typedef void (*casioemu_frame_fn)(void *user, const uint8_t *screen, size_t screen_size);
+
+/**
+ * Events a plugin may subscribe to (since ABI version 2). The meaning of
+ * (arg0) and (arg1) is given for each event.
+ */
+enum {
+    CASIOEMU_EVENT_HALT,      /* HALT or STOP mode was entered; arg0 is 1 for HALT, 0 for STOP */
+    CASIOEMU_EVENT_INTERRUPT, /* the CPU took interrupt arg0 */
+    CASIOEMU_EVENT_FRAME,     /* the screen changed during the last emulated frame */
+    CASIOEMU_EVENT_KEY,       /* button arg0 (its code in the model's button_map) was pressed (arg1 = 1) or released */
+    CASIOEMU_EVENT_MEM_ERROR, /* unmapped memory or ROM at arg0 was read (arg1 = 0) or written */
+    CASIOEMU_EVENT_COUNT
+};
+typedef void (*casioemu_event_fn)(void *user, int event, uint32_t arg0, uint32_t arg1);
+
+struct casioemu_host {
+    uint32_t abi_version;
+    int hardware_id; /* 3 for ES PLUS, 4 for ClassWiz */
+
+    const casioemu_cpu *cpu;
+    /**
+     * The battery backed RAM, mapped at (ram_base). Writing here bypasses
+     * watchpoints, just like data:write(offset, bytes, true).
+     */
+    uint8_t *ram;
+    uint32_t ram_base;
+    size_t ram_size;
+
+    /**
+     * Opaque to plugins.
+     */
+    void *context;
+
+    /**
+     * The registration functions return 0 on success and -1 if the arguments
+     * are invalid. Callbacks cannot be removed; they stay until the emulator
+     * is destroyed.
+     */
+    int (*add_instruction_hook)(casioemu_host *host, casioemu_instruction_fn fn, void *user);
+    /**
+     * Watch data accesses to [begin, end). Either callback may be NULL.
+     */
+    int (*add_memory_watch)(casioemu_host *host, uint32_t begin, uint32_t end, casioemu_memory_fn on_read, casioemu_memory_fn on_write, void *user);
+    /**
+     * Map a new peripheral at [base, base + size). The range must not overlap
+     * any other region. Plugin regions are not part of emu:save_state().
+     */
+    int (*add_region)(casioemu_host *host, uint32_t base, uint32_t size, const char *name, casioemu_region_read_fn read, casioemu_region_write_fn write, void *user);
+    int (*add_frame_hook)(casioemu_host *host, casioemu_frame_fn fn, void *user);
+
+    /**
+     * The value of a command line key, "" for a key given without a value,
+     * or NULL if the key was not given.
+     */
+    const char *(*get_option)(casioemu_host *host, const char *key);
+    void (*log)(casioemu_host *host, const char *message);
+
+    /* ABI version 2 */
+    int (*subscribe)(casioemu_host *host, int event, casioemu_event_fn fn, void *user);
+};
+
+/**
+ * Returns 0 on success. Any other value aborts the emulator.
+ */
+typedef int (*casioemu_plugin_init_fn)(casioemu_host *host);
+typedef void (*casioemu_plugin_exit_fn)(casioemu_host *host);
+
+#define CASIOEMU_PLUGIN_INIT "casioemu_plugin_init"
+#define CASIOEMU_PLUGIN_EXIT "casioemu_plugin_exit"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -56,7 +56,12 @@ do
 		rsd_up    = {410, 224, 10, 14, 319, 127},
 		rsd_disp  = {410, 238, 20, 14, 329, 127},
 		ink_colour = {49, 49, 49}, --[[ink_colour = {30, 52, 90},--]]
-		button_map = buttons
+		button_map = buttons,
+		-- Names for emu:keys, in addition to the key names above.
+		key_names = {
+			['+'] = 0x30, ['-'] = 0x40, ['*'] = 0x31, ['/'] = 0x41, ['='] = 0x60, ['.'] = 0x63,
+			shift = 0x07, alpha = 0x17, mode = 0x47, on = 0xFF, del = 0x32, ac = 0x42, ans = 0x61,
+		}
 	})
 end
 